@@ -0,0 +1,65 @@
+#include "asset_loader.h"
+#include <algorithm>
+
+AssetLoader::AssetLoader(int numThreads /* = 0 */)
+{
+	if (numThreads <= 0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	for (int i = 0; i < numThreads; ++i)
+		m_workers.emplace_back(&AssetLoader::WorkerLoop, this);
+}
+
+AssetLoader::~AssetLoader()
+{
+	WaitAll();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_jobAvailable.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void AssetLoader::WaitAll()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [&]() { return m_jobs.empty() && m_activeJobs == 0; });
+}
+
+void AssetLoader::Push(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_jobAvailable.notify_one();
+}
+
+void AssetLoader::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobAvailable.wait(lock, [&]() { return m_quit || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			++m_activeJobs;
+		}
+
+		job();
+
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_activeJobs;
+			idle = m_jobs.empty() && m_activeJobs == 0;
+		}
+		if (idle)
+			m_idle.notify_all();
+	}
+}
\ No newline at end of file
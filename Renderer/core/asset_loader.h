@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+// worker pool for asset loads, jobs run in the order they are submitted.
+// jobs may submit more jobs but must not wait on each other. openmp loops inside a job start a full team,
+// jobs that run side by side in numbers limit their own loops
+class AssetLoader
+{
+public:
+	// 0 uses one thread per hardware thread
+	AssetLoader(int numThreads = 0);
+	// waits for every job
+	~AssetLoader();
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	template <typename Func>
+	auto Submit(Func&& func) -> std::future<decltype(func())>
+	{
+		using Result = decltype(func());
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+		std::future<Result> result = task->get_future();
+		Push([task]() { (*task)(); });
+		return result;
+	}
+	// blocks until every job submitted so far, and the jobs they submitted, has finished
+	void WaitAll();
+
+private:
+	void Push(std::function<void()> job);
+	void WorkerLoop();
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_jobAvailable;
+	std::condition_variable m_idle;
+	int m_activeJobs = 0;
+	bool m_quit = false;
+};
\ No newline at end of file
@@ -87,6 +87,16 @@ float3 Camera::GetTarget() const
 	return m_target;
 }
 
+float3 Camera::GetForward() const
+{
+	return m_forward;
+}
+
+float Camera::GetNear() const
+{
+	return m_near;
+}
+
 float4x4 Camera::GetViewMatrix() const
 {
 	return m_viewMatrix;
@@ -19,6 +19,8 @@ public:
 	void SetCameraType(bool isPerspective);
 	float3 GetPosition() const;
 	float3 GetTarget() const;
+	float3 GetForward() const;
+	float GetNear() const;
 	float4x4 GetViewMatrix() const;
 	float4x4 GetProjectionMatrix() const;
 	void Update(const float4& deltaCursor, const float deltaScroll);
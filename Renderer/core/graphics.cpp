@@ -1,5 +1,7 @@
 #include "graphics.h"
+#include "pixel_convert.h"
 #include "math/math.h"
+#include <cstddef>
 
 void PSInput::LerpAssgin(const PSInput& v0, const PSInput& v1, float t)
 {
@@ -13,6 +15,74 @@ void PSInput::LerpAssgin(const PSInput& v0, const PSInput& v1, float t)
 	bitangent = Lerp(v0.bitangent, v1.bitangent, t);
 }
 
+PackedVertex PackVertex(const Vertex& vertex, const float3& positionOffset, const float3& positionScale)
+{
+	PackedVertex packed;
+	float p[3] = { vertex.position.x - positionOffset.x, vertex.position.y - positionOffset.y, vertex.position.z - positionOffset.z };
+	float s[3] = { positionScale.x, positionScale.y, positionScale.z };
+	uint16_t q[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		float x = s[i] > 0.0f ? p[i] / s[i] : 0.0f;
+		q[i] = (uint16_t)std::lround(std::clamp(x, 0.0f, 65535.0f));
+	}
+	packed.Position.X = q[0];
+	packed.Position.Y = q[1];
+	packed.Position.Z = q[2];
+	packed.Position.BitangentSign = Dot(Cross(vertex.normal, vertex.tangent), vertex.bitangent) < 0.0f ? -1 : 1;
+	OctEncode(vertex.normal, packed.Attributes.Normal);
+	OctEncode(vertex.tangent, packed.Attributes.Tangent);
+	packed.Attributes.UV[0] = FloatToHalf(vertex.uv.x);
+	packed.Attributes.UV[1] = FloatToHalf(vertex.uv.y);
+	packed.Attributes.Color = PackUnorm4x8(vertex.color);
+	return packed;
+}
+
+void UnpackVertex(const PackedPosition& position, const PackedAttributes* attributes, const float3& positionOffset, const float3& positionScale, Vertex& vertex)
+{
+	vertex.position = float3(
+		positionOffset.x + (float)position.X * positionScale.x,
+		positionOffset.y + (float)position.Y * positionScale.y,
+		positionOffset.z + (float)position.Z * positionScale.z);
+	if (attributes == nullptr)
+		return;
+	vertex.normal = OctDecode(attributes->Normal);
+	vertex.tangent = OctDecode(attributes->Tangent);
+	vertex.bitangent = Cross(vertex.normal, vertex.tangent) * (float)position.BitangentSign;
+	vertex.uv = float2(HalfToFloat(attributes->UV[0]), HalfToFloat(attributes->UV[1]));
+	vertex.color = UnpackUnorm4x8(attributes->Color);
+}
+
+VSInput* GraphicsContext::FetchVertex(uint32_t location, VSInput& scratch) const
+{
+	if (m_vertexBuffer != nullptr)
+		return &m_vertexBuffer[location];
+
+	const uint8_t* position = (const uint8_t*)m_positionStream + (size_t)location * m_positionStride;
+	const uint8_t* attributes = nullptr;
+	if (m_pipelineState->VertexInput == Vertex_Input_All && m_attributeStream != nullptr)
+		attributes = (const uint8_t*)m_attributeStream + (size_t)location * m_attributeStride;
+
+	if (m_packedVertices)
+	{
+		UnpackVertex(*(const PackedPosition*)position, (const PackedAttributes*)attributes, m_positionOffset, m_positionScale, scratch);
+	}
+	else
+	{
+		scratch.position = *(const float3*)position;
+		if (attributes != nullptr)
+		{
+			const VertexAttributes* attri = (const VertexAttributes*)attributes;
+			scratch.uv = attri->uv;
+			scratch.normal = attri->normal;
+			scratch.tangent = attri->tangent;
+			scratch.bitangent = attri->bitangent;
+			scratch.color = attri->color;
+		}
+	}
+	return &scratch;
+}
+
 bool InsideClippingPlane(eHomoClippingPlane plane, const float4& coord);
 
 float LineSegmentIntersectClippingPlane(eHomoClippingPlane plane, const float4& p0, const float4& p1);
@@ -21,6 +91,8 @@ int TriangleClipping(std::array<VSOut, 10>& VSOutVertices, std::array<PSInput, 1
 
 bool DepthTest(eDepthFunc testFunc, float curDepth, float prevDepth);
 
+float BlendFactor(eBlend blend, const Color& src);
+
 void GraphicsContext::DrawIndexed(uint32_t indexCount, uint32_t startIndexLocation /* = 0 */, uint32_t baseVertexLocation /* = 0 */)
 {
 	auto num_faces = indexCount / 3;
@@ -28,206 +100,351 @@ void GraphicsContext::DrawIndexed(uint32_t indexCount, uint32_t startIndexLocati
 	for (int face_idx = 0; face_idx < num_faces; ++face_idx)
 	{
 		std::array<VSOut, 10> vs_out_vertices;
-		std::array<PSInput, 10> ps_in_vertices;
+		VSInput scratch;
 		// vertex shader stage
 		for (int i = 0; i < 3; ++i)
 		{
-			VSInput* vs_input = &m_vertexBuffer[baseVertexLocation + m_indexBuffer[startIndexLocation + face_idx * 3 + i]];
+			VSInput* vs_input = FetchVertex(baseVertexLocation + FetchIndex(startIndexLocation + face_idx * 3 + i), scratch);
 			vs_out_vertices[i] = m_pipelineState->VS(vs_input, m_constantBuffer);
 		}
+		DrawTriangle(vs_out_vertices);
+	}
+}
 
-		// triangle clipping
-		int num_ps_in = TriangleClipping(vs_out_vertices, ps_in_vertices);
+void GraphicsContext::MultiDrawIndexed(const DrawIndexedArgs* args, uint32_t drawCount)
+{
+	#pragma omp parallel for schedule(dynamic)
+	for (int draw_idx = 0; draw_idx < (int)drawCount; ++draw_idx)
+	{
+		const DrawIndexedArgs& draw_args = args[draw_idx];
+		// small direct mapped post transform cache, local to the task
+		uint32_t cache_tags[VERTEX_CACHE_SIZE];
+		VSOut cache_vertices[VERTEX_CACHE_SIZE];
+		std::fill(cache_tags, cache_tags + VERTEX_CACHE_SIZE, UINT32_MAX);
 
-		for (int v_idx = 0; v_idx < num_ps_in - 2; ++v_idx)
+		std::array<VSOut, 10> vs_out_vertices;
+		VSInput scratch;
+		auto num_faces = draw_args.IndexCount / 3;
+		for (uint32_t face_idx = 0; face_idx < num_faces; ++face_idx)
 		{
-			int idx0 = 0;
-			int idx1 = v_idx + 1;
-			int idx2 = v_idx + 2;
-
-			// triangle assembly
-			ps_in_vertices[0] = vs_out_vertices[idx0];
-			ps_in_vertices[1] = vs_out_vertices[idx1];
-			ps_in_vertices[2] = vs_out_vertices[idx2];
-
-			// rasterize triangle
-			// perspective division
-			float3 ndc_coords[3];
-			float recip_w[3];
+			// vertex shader stage
 			for (int i = 0; i < 3; ++i)
 			{
-				recip_w[i] = 1.f / ps_in_vertices[i].sv_position.w;
-				ps_in_vertices[i].sv_position = ps_in_vertices[i].sv_position / ps_in_vertices[i].sv_position.w;
-				ndc_coords[i] = float3(ps_in_vertices[i].sv_position);
+				uint32_t index = FetchIndex(draw_args.StartIndexLocation + face_idx * 3 + i);
+				uint32_t slot = index % VERTEX_CACHE_SIZE;
+				if (cache_tags[slot] != index)
+				{
+					cache_tags[slot] = index;
+					cache_vertices[slot] = m_pipelineState->VS(FetchVertex(draw_args.BaseVertexLocation + index, scratch), m_constantBuffer);
+				}
+				vs_out_vertices[i] = cache_vertices[slot];
 			}
+			DrawTriangle(vs_out_vertices);
+		}
+	}
+}
 
-			// face culling
-			if (m_pipelineState->RasterizerState.CullMode != Cull_Mode_None)
-			{
-				auto v0 = ndc_coords[0];
-				auto v1 = ndc_coords[1];
-				auto v2 = ndc_coords[2];
-				float r = Dot(v0, Cross(v1 - v0, v2 - v0));
-
-				bool is_back_face = !(r < 0 ^ m_pipelineState->RasterizerState.FrontCounterClockWise);
-				bool is_culling = !(m_pipelineState->RasterizerState.CullMode == Cull_Mode_Back ^ is_back_face);
-				if (is_culling)
-					continue;
-			}
+void GraphicsContext::DrawTriangle(std::array<VSOut, 10>& vs_out_vertices)
+{
+	std::array<PSInput, 10> ps_in_vertices;
+	// shaded pixels are converted and stored in batches
+	Color shaded_colors[PIXEL_BATCH_SIZE];
+	int shaded_x[PIXEL_BATCH_SIZE];
+	int shaded_y[PIXEL_BATCH_SIZE];
+	int num_shaded = 0;
 
-			// viewport mapping
-			float2 screen_coords[3];
-			float screen_depth[3];
-			for (int i = 0; i < 3; ++i)
-			{
-				float3 ndc_coord = float3(ps_in_vertices[i].sv_position);
-				float x = (ndc_coord.x + 1.f) * 0.5f * (float)m_viewport->Width + m_viewport->TopLeftX;
-				float y = (1.f - ndc_coord.y) * 0.5f * (float)m_viewport->Height + m_viewport->TopLeftY;
-				float z = m_viewport->MinDepth + ndc_coord.z * (m_viewport->MaxDepth - m_viewport->MinDepth);
-				ps_in_vertices[i].sv_position = float4(x, y, z, 1.0f);
-				screen_coords[i] = float2(x, y);
-				screen_depth[i] = z;
-			}
+	// triangle clipping
+	int num_ps_in = TriangleClipping(vs_out_vertices, ps_in_vertices);
 
-			// build bounding box
-			float2 range_min = Min(screen_coords[0], Min(screen_coords[1], screen_coords[2]));
-			float2 range_max = Max(screen_coords[0], Max(screen_coords[1], screen_coords[2]));
-			int x_min = (int)std::floor(range_min.x);
-			int y_min = (int)std::floor(range_min.y);
-			int x_max = (int)std::ceil(range_max.x);
-			int y_max = (int)std::ceil(range_max.y);
-			x_min = std::max(x_min, 0);
-			x_max = std::min(x_max, (int)m_viewport->Width);
-			y_min = std::max(y_min, 0);
-			y_max = std::min(y_max, (int)m_viewport->Height);
-
-			// TODO: add wire frame rasterizer mode
-	//#pragma omp parallel for schedule(dynamic)
-			for (int x = x_min; x < x_max; ++x)
+	for (int v_idx = 0; v_idx < num_ps_in - 2; ++v_idx)
+	{
+		int idx0 = 0;
+		int idx1 = v_idx + 1;
+		int idx2 = v_idx + 2;
+
+		// triangle assembly
+		ps_in_vertices[0] = vs_out_vertices[idx0];
+		ps_in_vertices[1] = vs_out_vertices[idx1];
+		ps_in_vertices[2] = vs_out_vertices[idx2];
+
+		// rasterize triangle
+		// perspective division
+		float3 ndc_coords[3];
+		float recip_w[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			recip_w[i] = 1.f / ps_in_vertices[i].sv_position.w;
+			ps_in_vertices[i].sv_position = ps_in_vertices[i].sv_position / ps_in_vertices[i].sv_position.w;
+			ndc_coords[i] = float3(ps_in_vertices[i].sv_position);
+		}
+
+		// face culling
+		if (m_pipelineState->RasterizerState.CullMode != Cull_Mode_None)
+		{
+			auto v0 = ndc_coords[0];
+			auto v1 = ndc_coords[1];
+			auto v2 = ndc_coords[2];
+			float r = Dot(v0, Cross(v1 - v0, v2 - v0));
+
+			bool is_back_face = !(r < 0 ^ m_pipelineState->RasterizerState.FrontCounterClockWise);
+			bool is_culling = !(m_pipelineState->RasterizerState.CullMode == Cull_Mode_Back ^ is_back_face);
+			if (is_culling)
+				continue;
+		}
+
+		// viewport mapping
+		float2 screen_coords[3];
+		float screen_depth[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			float3 ndc_coord = float3(ps_in_vertices[i].sv_position);
+			float x = (ndc_coord.x + 1.f) * 0.5f * (float)m_viewport->Width + m_viewport->TopLeftX;
+			float y = (1.f - ndc_coord.y) * 0.5f * (float)m_viewport->Height + m_viewport->TopLeftY;
+			float z = m_viewport->MinDepth + ndc_coord.z * (m_viewport->MaxDepth - m_viewport->MinDepth);
+			ps_in_vertices[i].sv_position = float4(x, y, z, 1.0f);
+			screen_coords[i] = float2(x, y);
+			screen_depth[i] = z;
+		}
+
+		// build bounding box
+		float2 range_min = Min(screen_coords[0], Min(screen_coords[1], screen_coords[2]));
+		float2 range_max = Max(screen_coords[0], Max(screen_coords[1], screen_coords[2]));
+		int x_min = (int)std::floor(range_min.x);
+		int y_min = (int)std::floor(range_min.y);
+		int x_max = (int)std::ceil(range_max.x);
+		int y_max = (int)std::ceil(range_max.y);
+		x_min = std::max(x_min, 0);
+		x_max = std::min(x_max, (int)m_viewport->Width);
+		y_min = std::max(y_min, 0);
+		y_max = std::min(y_max, (int)m_viewport->Height);
+
+		auto barycentric = [&](const float2& point) -> float3
+		{
+			float2 a = screen_coords[0];
+			float2 b = screen_coords[1];
+			float2 c = screen_coords[2];
+			float2 bp = point - b;
+			float2 bc = c - b;
+			float2 ba = a - b;
+			float2 cp = point - c;
+			float2 ca = a - c;
+			float alpha = (-bp.x * bc.y + bp.y * bc.x) / (-ba.x * bc.y + ba.y * bc.x);
+			float beta = (-cp.x * ca.y + cp.y * ca.x) / (bc.x * ca.y - bc.y * ca.x);
+			return float3(alpha, beta, 1 - alpha - beta);
+		};
+		auto perspective_uv = [&](const float3& weights) -> float2
+		{
+			float weight0 = recip_w[0] * weights.x;
+			float weight1 = recip_w[1] * weights.y;
+			float weight2 = recip_w[2] * weights.z;
+			float norm = 1.f / (weight0 + weight1 + weight2);
+			return (ps_in_vertices[0].uv * weight0 + ps_in_vertices[1].uv * weight1 + ps_in_vertices[2].uv * weight2) * norm;
+		};
+
+		// TODO: add wire frame rasterizer mode
+//#pragma omp parallel for schedule(dynamic)
+		for (int x = x_min; x < x_max; ++x)
+		{
+			for (int y = y_min; y < y_max; ++y)
 			{
-				for (int y = y_min; y < y_max; ++y)
+				float2 point = float2((float)x + 0.5f, (float)y + 0.5f);
+				float3 weights = barycentric(point);
+				// if pixel inside triangle
+				if (weights.x > -std::numeric_limits<float>::epsilon() &&
+					weights.y > -std::numeric_limits<float>::epsilon() &&
+					weights.z > -std::numeric_limits<float>::epsilon())
 				{
-					float2 point = float2((float)x + 0.5f, (float)y + 0.5f);
-					float3 weights;
-					{
-						float2 a = screen_coords[0];
-						float2 b = screen_coords[1];
-						float2 c = screen_coords[2];
-						float2 bp = point - b;
-						float2 bc = c - b;
-						float2 ba = a - b;
-						float2 cp = point - c;
-						float2 ca = a - c;
-						float alpha = (-bp.x * bc.y + bp.y * bc.x) / (-ba.x * bc.y + ba.y * bc.x);
-						float beta = (-cp.x * ca.y + cp.y * ca.x) / (bc.x * ca.y - bc.y * ca.x);
-						weights = float3(alpha, beta, 1 - alpha - beta);
-					}
-					// if pixel inside triangle
-					if (weights.x > -std::numeric_limits<float>::epsilon() &&
-						weights.y > -std::numeric_limits<float>::epsilon() &&
-						weights.z > -std::numeric_limits<float>::epsilon())
-					{
-						// interpolate depth
-						float depth = screen_depth[0] * weights.x + screen_depth[1] * weights.y + screen_depth[2] * weights.z;
+					// interpolate depth
+					float depth = screen_depth[0] * weights.x + screen_depth[1] * weights.y + screen_depth[2] * weights.z;
 
-						// early depth test
-						if (m_depthBuffer != nullptr && m_pipelineState->DepthStencilState.DepthEnable)
+					// early depth test
+					if (m_depthBuffer != nullptr && m_pipelineState->DepthStencilState.DepthEnable)
+					{
+						float prev_depth = m_depthBuffer->GetValue(x, y);
+						if (!DepthTest(m_pipelineState->DepthStencilState.DepthFunc, depth, prev_depth))
+						{
+							continue;
+						}
+						else
 						{
-							float prev_depth = m_depthBuffer->GetValue(x, y);
-							if (!DepthTest(m_pipelineState->DepthStencilState.DepthFunc, depth, prev_depth))
-							{
-								continue;
-							}
-							else
-							{
-								m_depthBuffer->SetValue(x, y, depth);
-							}
+							m_depthBuffer->SetValue(x, y, depth);
 						}
+					}
 
-						// interpolate vertex attributes
-						if (m_frameBuffer == nullptr)
-							continue;
-						PSInput pixel_attri;
+					// interpolate vertex attributes
+					if (!HasColorTarget())
+						continue;
+					PSInput pixel_attri;
+					{
+						float* a0 = (float*)&(ps_in_vertices[0]);
+						float* a1 = (float*)&(ps_in_vertices[1]);
+						float* a2 = (float*)&(ps_in_vertices[2]);
+						float* r = (float*)&pixel_attri;
+						float weight0 = recip_w[0] * weights.x;
+						float weight1 = recip_w[1] * weights.y;
+						float weight2 = recip_w[2] * weights.z;
+						float norm = 1.f / (weight0 + weight1 + weight2);
+						// perspective correct interpolation
+						for (int j = 0; j < offsetof(PSInput, uvDdx) / sizeof(float); ++j)
 						{
-							float* a0 = (float*)&(ps_in_vertices[0]);
-							float* a1 = (float*)&(ps_in_vertices[1]);
-							float* a2 = (float*)&(ps_in_vertices[2]);
-							float* r = (float*)&pixel_attri;
-							float weight0 = recip_w[0] * weights.x;
-							float weight1 = recip_w[1] * weights.y;
-							float weight2 = recip_w[2] * weights.z;
-							float norm = 1.f / (weight0 + weight1 + weight2);
-							// perspective correct interpolation
-							for (int j = 0; j < sizeof(PSInput) / sizeof(float); ++j)
-							{
-								float attri = norm * (a0[j] * weight0 + a1[j] * weight1 + a2[j] * weight2);
-								r[j] = attri;
-							}
+							float attri = norm * (a0[j] * weight0 + a1[j] * weight1 + a2[j] * weight2);
+							r[j] = attri;
 						}
-						// TODO: multiple render targets
-						// pixel shader stage
-						Color pixel_color = m_pipelineState->PS(&pixel_attri, m_constantBuffer, m_textureSlots, m_samplerSlots);
+						// differences to the neighbouring pixels, like a 2x2 quad would give
+						pixel_attri.uvDdx = perspective_uv(barycentric(point + float2(1.0f, 0.0f))) - pixel_attri.uv;
+						pixel_attri.uvDdy = perspective_uv(barycentric(point + float2(0.0f, 1.0f))) - pixel_attri.uv;
+					}
+					// TODO: multiple render targets
+					// pixel shader stage
+					Color pixel_color = m_pipelineState->PS(&pixel_attri, m_constantBuffer, m_textureSlots, m_samplerSlots);
 
-						// TODO:: add blend
-						m_frameBuffer->SetColorBGR(x, y, pixel_color);
+					shaded_colors[num_shaded] = pixel_color;
+					shaded_x[num_shaded] = x;
+					shaded_y[num_shaded] = y;
+					if (++num_shaded == PIXEL_BATCH_SIZE)
+					{
+						WritePixels(shaded_colors, shaded_x, shaded_y, num_shaded);
+						num_shaded = 0;
 					}
 				}
 			}
 		}
 	}
+	WritePixels(shaded_colors, shaded_x, shaded_y, num_shaded);
 }
 
-void GraphicsContext::ClearDepth(DepthBuffer* depthBuffer, float value)
+void GraphicsContext::WritePixels(const Color* colors, const int* x, const int* y, int count)
 {
-	int width = depthBuffer->GetWidth();
-	int height = depthBuffer->GetHeight();
-#pragma omp parallel for schedule(dynamic)
-	for (int x = 0; x < width; ++x)
+	const BlendDesc& blend = m_pipelineState->BlendState;
+	Color blended[PIXEL_BATCH_SIZE];
+	if (blend.BlendEnable)
 	{
-		for (int y = 0; y < height; ++y)
+		for (int i = 0; i < count; ++i)
 		{
-			int index = width * y * DepthBuffer::channels + x * DepthBuffer::channels;
-			depthBuffer->SetValue(index, value);
+			Color dest = ReadPixel(x[i], y[i]);
+			blended[i] = colors[i] * BlendFactor(blend.SrcBlend, colors[i]) + dest * BlendFactor(blend.DestBlend, colors[i]);
 		}
+		colors = blended;
 	}
+
+	if (m_halfColorBuffer != nullptr)
+	{
+		uint16_t half[PIXEL_BATCH_SIZE * 4];
+		ConvertFloatToHalf(&colors[0].x, half, (size_t)count * 4);
+		for (int i = 0; i < count; ++i)
+			m_halfColorBuffer->SetPixel(x[i], y[i], half + i * 4);
+		return;
+	}
+
+	uint32_t bgra[PIXEL_BATCH_SIZE];
+	ConvertToBGRA8(colors, bgra, count);
+	for (int i = 0; i < count; ++i)
+	{
+		if (m_tiledFrameBuffer != nullptr)
+			m_tiledFrameBuffer->SetPixel(x[i], y[i], (const uint8_t*)&bgra[i]);
+		else
+			m_frameBuffer->SetPixel(x[i], y[i], (const uint8_t*)&bgra[i]);
+	}
+}
+
+Color GraphicsContext::ReadPixel(int x, int y) const
+{
+	if (m_halfColorBuffer != nullptr)
+		return m_halfColorBuffer->GetColor(x, y);
+	uint8_t bgra[4];
+	if (m_tiledFrameBuffer != nullptr)
+		m_tiledFrameBuffer->GetPixel(x, y, bgra);
+	else
+		m_frameBuffer->GetPixel(x, y, bgra);
+	return Color(bgra[2], bgra[1], bgra[0], bgra[3]) / 255.0f;
+}
+
+void GraphicsContext::ClearDepth(DepthBuffer* depthBuffer, float value)
+{
+	depthBuffer->Clear(&value);
 }
 
 void GraphicsContext::ClearColor(FrameBuffer* frameBuffer, const Color& value)
 {
-	int width = frameBuffer->GetWidth();
-	int height = frameBuffer->GetHeight();
-#pragma omp parallel for schedule(dynamic)
-	for (int x = 0; x < width; ++x)
+	uint32_t bgra;
+	ConvertToBGRA8(&value, &bgra, 1);
+	frameBuffer->Clear((const uint8_t*)&bgra);
+}
+
+void GraphicsContext::ClearColor(TiledFrameBuffer* frameBuffer, const Color& value)
+{
+	uint32_t bgra;
+	ConvertToBGRA8(&value, &bgra, 1);
+	frameBuffer->Clear((const uint8_t*)&bgra);
+}
+
+void GraphicsContext::ClearColor(ColorBuffer* colorBuffer, const Color& value)
+{
+	float rgba[4] = { value.x, value.y, value.z, value.w };
+	colorBuffer->Clear(rgba);
+}
+
+void GraphicsContext::ClearColor(HalfColorBuffer* colorBuffer, const Color& value)
+{
+	uint16_t half[4];
+	ConvertFloatToHalf(&value.x, half, 4);
+	colorBuffer->Clear(half);
+}
+
+
+void GraphicsContext::CopyToFrameBuffer(ColorBuffer* colorBuffer, FrameBuffer* frameBuffer, bool srgbEncode /* = false */)
+{
+	int width = std::min(colorBuffer->GetWidth(), frameBuffer->GetWidth());
+	int height = std::min(colorBuffer->GetHeight(), frameBuffer->GetHeight());
+	const Color* src = (const Color*)colorBuffer->GetBuffer();
+	uint32_t* dst = (uint32_t*)frameBuffer->GetBuffer();
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; ++y)
 	{
-		for (int y = 0; y < height; ++y)
-		{
-			int index = width * y * FrameBuffer::channels + x * FrameBuffer::channels;
-			frameBuffer->SetValue(index, std::clamp(value.z, 0.0f, 1.0f) * 255);
-			frameBuffer->SetValue(index + 1, std::clamp(value.y, 0.0f, 1.0f) * 255);
-			frameBuffer->SetValue(index + 2, std::clamp(value.x, 0.0f, 1.0f) * 255);
-		}
+		ConvertToBGRA8(src + (size_t)y * colorBuffer->GetWidth(), dst + (size_t)y * frameBuffer->GetWidth(), width, srgbEncode);
 	}
 }
 
-void GraphicsContext::ClearColor(ColorBuffer* colorBuffer, const Color& value)
+void GraphicsContext::CopyToFrameBuffer(HalfColorBuffer* colorBuffer, FrameBuffer* frameBuffer, bool srgbEncode /* = false */)
 {
-	int width = colorBuffer->GetWidth();
-	int height = colorBuffer->GetHeight();
-#pragma omp parallel for schedule(dynamic)
-	for (int x = 0; x < width; ++x)
+	colorBuffer->ConvertTo(*frameBuffer, [srgbEncode](const uint16_t* src, uint8_t* dst, size_t count)
 	{
-		for (int y = 0; y < height; ++y)
+		// count is at most a tile
+		Color colors[PIXEL_TILE_SIZE * PIXEL_TILE_SIZE];
+		ConvertHalfToFloat(src, &colors[0].x, count * 4);
+		ConvertToBGRA8(colors, (uint32_t*)dst, count, srgbEncode);
+	});
+}
+
+void GraphicsContext::Tonemap(HalfColorBuffer* colorBuffer, FrameBuffer* frameBuffer, const TonemapDesc& desc)
+{
+	colorBuffer->ConvertTo(*frameBuffer, [&desc](const uint16_t* src, uint8_t* dst, size_t count)
+	{
+		// count is at most a tile
+		Color colors[PIXEL_TILE_SIZE * PIXEL_TILE_SIZE];
+		ConvertHalfToFloat(src, &colors[0].x, count * 4);
+		TonemapColors(colors, count, desc);
+		ConvertToBGRA8(colors, (uint32_t*)dst, count, desc.SRGBEncode);
+	});
+}
+
+void GraphicsContext::Tonemap(ColorBuffer* colorBuffer, FrameBuffer* frameBuffer, const TonemapDesc& desc)
+{
+	colorBuffer->ConvertTo(*frameBuffer, [&desc](const float* src, uint8_t* dst, size_t count)
+	{
+		// rows are tonemapped in chunks that stay in l1
+		const size_t chunk_size = PIXEL_TILE_SIZE * PIXEL_TILE_SIZE;
+		Color colors[chunk_size];
+		for (size_t i = 0; i < count; i += chunk_size)
 		{
-			int index = width * y * ColorBuffer::channels + x * ColorBuffer::channels;
-			colorBuffer->SetValue(index, value.x);
-			colorBuffer->SetValue(index, value.y);
-			colorBuffer->SetValue(index, value.z);
-			colorBuffer->SetValue(index, value.w);
+			size_t n = std::min(chunk_size, count - i);
+			std::memcpy(colors, src + i * 4, n * sizeof(Color));
+			TonemapColors(colors, n, desc);
+			ConvertToBGRA8(colors, (uint32_t*)dst + i, n, desc.SRGBEncode);
 		}
-	}
+	});
 }
 
-
 bool InsideClippingPlane(eHomoClippingPlane plane, const float4& coord)
 {
 	switch (plane)
@@ -338,4 +555,21 @@ bool DepthTest(eDepthFunc testFunc, float curDepth, float prevDepth)
 	default:
 		return false;
 	}
+}
+
+float BlendFactor(eBlend blend, const Color& src)
+{
+	switch (blend)
+	{
+	case Blend_Zero:
+		return 0.0f;
+	case Blend_One:
+		return 1.0f;
+	case Blend_Src_Alpha:
+		return src.w;
+	case Blend_Inv_Src_Alpha:
+		return 1.0f - src.w;
+	default:
+		return 1.0f;
+	}
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include "sampler.h"
 
 #define MAX_RENDER_TARGET 8
+#define VERTEX_CACHE_SIZE 32
+#define PIXEL_BATCH_SIZE 8
 
 struct VSInput
 {
@@ -18,6 +20,41 @@ struct VSInput
 	Color color;
 };
 
+// everything but the position, laid out like the rest of VSInput
+struct VertexAttributes
+{
+	float2 uv;
+	float3 normal;
+	float3 tangent;
+	float3 bitangent;
+	Color color;
+};
+
+// positions quantized to a box given at bind time, w carries the bitangent sign so the attributes stay 16 bytes
+struct PackedPosition
+{
+	uint16_t X;
+	uint16_t Y;
+	uint16_t Z;
+	int16_t BitangentSign;
+};
+
+// octahedral normal and tangent, the bitangent is rebuilt as cross(normal, tangent) * BitangentSign
+struct PackedAttributes
+{
+	int16_t Normal[2];
+	int16_t Tangent[2];
+	uint16_t UV[2];
+	uint32_t Color;
+};
+
+// 24 byte interleaved vertex
+struct PackedVertex
+{
+	PackedPosition Position;
+	PackedAttributes Attributes;
+};
+
 struct PSInput
 {
 	float4 sv_position;
@@ -28,6 +65,9 @@ struct PSInput
 	float4 color;
 	float3 tangent;
 	float3 bitangent;
+	// screen space derivatives of uv, filled in by the rasterizer for texture level of detail
+	float2 uvDdx;
+	float2 uvDdy;
 	void LerpAssgin(const PSInput& v0, const PSInput& v1, float t);
 };
 
@@ -43,6 +83,10 @@ struct ConstantBuffer
 using VSOut = PSInput;
 using Vertex = VSInput;
 
+PackedVertex PackVertex(const Vertex& vertex, const float3& positionOffset, const float3& positionScale);
+// attributes may be null to only decode the position
+void UnpackVertex(const PackedPosition& position, const PackedAttributes* attributes, const float3& positionOffset, const float3& positionScale, Vertex& vertex);
+
 using VertexShader = std::function<VSOut(VSInput*, void**)>;
 using PixelShader = std::function<Color(PSInput*, void**, void**, SamplerState**)>;
 
@@ -111,12 +155,50 @@ struct DepthStencilDesc
 
 };
 
+enum eBlend
+{
+	Blend_Zero,
+	Blend_One,
+	Blend_Src_Alpha,
+	Blend_Inv_Src_Alpha
+};
+
+// result = src * SrcBlend + dest * DestBlend, for color and alpha alike
+struct BlendDesc
+{
+	bool BlendEnable = false;
+	eBlend SrcBlend = Blend_One;
+	eBlend DestBlend = Blend_Zero;
+};
+
+enum eVertexInput
+{
+	Vertex_Input_All,
+	Vertex_Input_Position
+};
+
 struct PipelineState
 {
 	VertexShader VS;
 	PixelShader PS;
+	// position only shaders don't fetch the attribute stream of split or packed vertices
+	eVertexInput VertexInput = Vertex_Input_All;
 	RasterizerDesc RasterizerState;
 	DepthStencilDesc DepthStencilState;
+	BlendDesc BlendState;
+};
+
+enum eIndexFormat
+{
+	Index_Format_16,
+	Index_Format_32
+};
+
+struct DrawIndexedArgs
+{
+	uint32_t IndexCount;
+	uint32_t StartIndexLocation;
+	uint32_t BaseVertexLocation;
 };
 
 class GraphicsContext
@@ -126,11 +208,37 @@ public:
 	{
 		m_numRTs = 1;
 		m_frameBuffer = frameBuffer;
+		m_tiledFrameBuffer = nullptr;
+		m_halfColorBuffer = nullptr;
+		m_depthBuffer = depthBuffer;
+	}
+	// depth only
+	void SetRenderTarget(std::nullptr_t, DepthBuffer* depthBuffer, StencilBuffer* stencilBuffer = nullptr)
+	{
+		SetRenderTarget((FrameBuffer*)nullptr, depthBuffer, stencilBuffer);
+	}
+	void SetRenderTarget(TiledFrameBuffer* frameBuffer, DepthBuffer* depthBuffer = nullptr, StencilBuffer* stencilBuffer = nullptr)
+	{
+		m_numRTs = 1;
+		m_frameBuffer = nullptr;
+		m_tiledFrameBuffer = frameBuffer;
+		m_halfColorBuffer = nullptr;
+		m_depthBuffer = depthBuffer;
+	}
+	// rgba16f, pixel shader output is stored unclamped
+	void SetRenderTarget(HalfColorBuffer* colorBuffer, DepthBuffer* depthBuffer = nullptr, StencilBuffer* stencilBuffer = nullptr)
+	{
+		m_numRTs = 1;
+		m_frameBuffer = nullptr;
+		m_tiledFrameBuffer = nullptr;
+		m_halfColorBuffer = colorBuffer;
 		m_depthBuffer = depthBuffer;
 	}
 	void SetRenderTargets(FrameBuffer* frameBuffer, uint8_t numRTs, ColorBuffer* colorBuffers[], DepthBuffer* depthBuffer = nullptr, StencilBuffer* stencilBuffer = nullptr)
 	{
 		m_frameBuffer = frameBuffer;
+		m_tiledFrameBuffer = nullptr;
+		m_halfColorBuffer = nullptr;
 		m_numRTs = numRTs + 1;
 		for (int i = 0; i < numRTs; ++i)
 		{
@@ -146,9 +254,32 @@ public:
 	{
 		m_vertexBuffer = vertexBuffer;
 	}
-	void SetIndexBuffer(uint32_t* indexBuffer)
+	// packed vertices are decoded when the vertex shader fetches them, position = offset + quantized * scale
+	void SetVertexBuffer(const PackedVertex* vertexBuffer, const float3& positionOffset, const float3& positionScale)
+	{
+		SetVertexStreams(&vertexBuffer->Position, sizeof(PackedVertex), &vertexBuffer->Attributes, sizeof(PackedVertex), true);
+		m_positionOffset = positionOffset;
+		m_positionScale = positionScale;
+	}
+	void SetVertexStreams(const float3* positions, const VertexAttributes* attributes)
+	{
+		SetVertexStreams(positions, sizeof(float3), attributes, sizeof(VertexAttributes), false);
+	}
+	void SetVertexStreams(const PackedPosition* positions, const PackedAttributes* attributes, const float3& positionOffset, const float3& positionScale)
+	{
+		SetVertexStreams(positions, sizeof(PackedPosition), attributes, sizeof(PackedAttributes), true);
+		m_positionOffset = positionOffset;
+		m_positionScale = positionScale;
+	}
+	void SetIndexBuffer(const uint32_t* indexBuffer)
+	{
+		m_indexBuffer = indexBuffer;
+		m_indexFormat = Index_Format_32;
+	}
+	void SetIndexBuffer(const uint16_t* indexBuffer)
 	{
 		m_indexBuffer = indexBuffer;
+		m_indexFormat = Index_Format_16;
 	}
 	void SetConstantBuffer(size_t slot, void* cb)
 	{
@@ -166,19 +297,68 @@ public:
 	{
 		m_viewport = viewport;
 	}
+	const PipelineState* GetPipelineState() const { return m_pipelineState; }
+	const Viewport* GetViewport() const { return m_viewport; }
 	void DrawIndexed(uint32_t indexCount, uint32_t startIndexLocation = 0, uint32_t baseVertexLocation = 0);
+	// draw several index ranges sharing the current state, one parallel task per range.
+	// vertex shader results are reused within a range, so ranges should be in vertex cache friendly order
+	void MultiDrawIndexed(const DrawIndexedArgs* args, uint32_t drawCount);
 
 	void ClearDepth(DepthBuffer* depthBuffer, float value);
 	void ClearColor(FrameBuffer* frameBuffer, const Color& value);
+	void ClearColor(TiledFrameBuffer* frameBuffer, const Color& value);
 	void ClearColor(ColorBuffer* colorBuffer, const Color& value);
+	void ClearColor(HalfColorBuffer* colorBuffer, const Color& value);
+	// converts to bgra8 row by row
+	void CopyToFrameBuffer(ColorBuffer* colorBuffer, FrameBuffer* frameBuffer, bool srgbEncode = false);
+	// converts to bgra8 tile by tile
+	void CopyToFrameBuffer(HalfColorBuffer* colorBuffer, FrameBuffer* frameBuffer, bool srgbEncode = false);
+	// present pass for hdr targets, tonemaps into a frame buffer of the same size with one task per row of tiles
+	void Tonemap(HalfColorBuffer* colorBuffer, FrameBuffer* frameBuffer, const TonemapDesc& desc);
+	void Tonemap(ColorBuffer* colorBuffer, FrameBuffer* frameBuffer, const TonemapDesc& desc);
 
 private:
+	uint32_t FetchIndex(uint32_t location) const
+	{
+		return m_indexFormat == Index_Format_16 ? ((const uint16_t*)m_indexBuffer)[location] : ((const uint32_t*)m_indexBuffer)[location];
+	}
+	void SetVertexStreams(const void* positions, uint32_t positionStride, const void* attributes, uint32_t attributeStride, bool packed)
+	{
+		m_vertexBuffer = nullptr;
+		m_positionStream = positions;
+		m_positionStride = positionStride;
+		m_attributeStream = attributes;
+		m_attributeStride = attributeStride;
+		m_packedVertices = packed;
+	}
+	// interleaved vertices are passed through, streams are gathered into scratch
+	VSInput* FetchVertex(uint32_t location, VSInput& scratch) const;
+	// expects the first three entries to hold the vertex shader outputs
+	void DrawTriangle(std::array<VSOut, 10>& vsOutVertices);
+	void WritePixels(const Color* colors, const int* x, const int* y, int count);
+	bool HasColorTarget() const
+	{
+		return m_frameBuffer != nullptr || m_tiledFrameBuffer != nullptr || m_halfColorBuffer != nullptr;
+	}
+	// current value of the bound color target, for blending
+	Color ReadPixel(int x, int y) const;
+
 	FrameBuffer* m_frameBuffer;
+	TiledFrameBuffer* m_tiledFrameBuffer = nullptr;
+	HalfColorBuffer* m_halfColorBuffer = nullptr;
 	ColorBuffer* m_multiRenderTargets[MAX_RENDER_TARGET];
 	DepthBuffer* m_depthBuffer;
 	uint8_t m_numRTs = 0;
-	Vertex* m_vertexBuffer;
-	uint32_t* m_indexBuffer;
+	Vertex* m_vertexBuffer = nullptr;
+	const void* m_positionStream = nullptr;
+	const void* m_attributeStream = nullptr;
+	uint32_t m_positionStride = 0;
+	uint32_t m_attributeStride = 0;
+	bool m_packedVertices = false;
+	float3 m_positionOffset;
+	float3 m_positionScale;
+	const void* m_indexBuffer;
+	eIndexFormat m_indexFormat = Index_Format_32;
 	PipelineState* m_pipelineState;
 	Viewport* m_viewport;
 	void* m_constantBuffer[10];
@@ -0,0 +1,101 @@
+#include "hiz_buffer.h"
+
+void HiZBuffer::Build(const DepthBuffer& depthBuffer)
+{
+	m_width = depthBuffer.GetWidth();
+	m_height = depthBuffer.GetHeight();
+	// an empty or single texel buffer has nothing to reduce, the hi-z stays empty and culls nothing
+	if (m_width <= 0 || m_height <= 0 || (m_width == 1 && m_height == 1))
+	{
+		m_levels.clear();
+		return;
+	}
+	if (m_levels.empty() || m_levels[0].Width != (m_width + 1) / 2 || m_levels[0].Height != (m_height + 1) / 2)
+	{
+		m_levels.clear();
+		int width = m_width;
+		int height = m_height;
+		while (width > 1 || height > 1)
+		{
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+			m_levels.push_back({ width, height, std::vector<float>(width * height) });
+		}
+	}
+
+	// first level reduces the depth buffer itself
+	{
+		Level& dst = m_levels[0];
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < dst.Height; ++y)
+		{
+			int y0 = y * 2;
+			int y1 = std::min(y0 + 1, m_height - 1);
+			for (int x = 0; x < dst.Width; ++x)
+			{
+				int x0 = x * 2;
+				int x1 = std::min(x0 + 1, m_width - 1);
+				float d = std::max(
+					std::max(depthBuffer.GetValue(x0, y0), depthBuffer.GetValue(x1, y0)),
+					std::max(depthBuffer.GetValue(x0, y1), depthBuffer.GetValue(x1, y1)));
+				dst.Depth[y * dst.Width + x] = d;
+			}
+		}
+	}
+
+	for (size_t i = 1; i < m_levels.size(); ++i)
+	{
+		const Level& src = m_levels[i - 1];
+		Level& dst = m_levels[i];
+		for (int y = 0; y < dst.Height; ++y)
+		{
+			int y0 = y * 2;
+			int y1 = std::min(y0 + 1, src.Height - 1);
+			for (int x = 0; x < dst.Width; ++x)
+			{
+				int x0 = x * 2;
+				int x1 = std::min(x0 + 1, src.Width - 1);
+				float d = std::max(
+					std::max(src.Depth[y0 * src.Width + x0], src.Depth[y0 * src.Width + x1]),
+					std::max(src.Depth[y1 * src.Width + x0], src.Depth[y1 * src.Width + x1]));
+				dst.Depth[y * dst.Width + x] = d;
+			}
+		}
+	}
+}
+
+bool HiZBuffer::IsOccluded(const float2& uvMin, const float2& uvMax, float nearestDepth) const
+{
+	if (m_levels.empty())
+		return false;
+
+	float2 px_min = Max(uvMin, float2(0.0f)) * float2((float)m_width, (float)m_height);
+	float2 px_max = Min(uvMax, float2(1.0f)) * float2((float)m_width, (float)m_height);
+	if (px_max.x < px_min.x || px_max.y < px_min.y)
+		return false;
+
+	// pick the level where the rect covers at most 2x2 texels
+	float size = std::max(px_max.x - px_min.x, px_max.y - px_min.y);
+	size_t level = 0;
+	float scale = 2.0f;
+	while (level + 1 < m_levels.size() && size > scale * 2.0f)
+	{
+		++level;
+		scale *= 2.0f;
+	}
+
+	const Level& lv = m_levels[level];
+	int x0 = std::clamp((int)(px_min.x / scale), 0, lv.Width - 1);
+	int y0 = std::clamp((int)(px_min.y / scale), 0, lv.Height - 1);
+	int x1 = std::clamp((int)(px_max.x / scale), 0, lv.Width - 1);
+	int y1 = std::clamp((int)(px_max.y / scale), 0, lv.Height - 1);
+	float max_depth = 0.0f;
+	for (int y = y0; y <= y1; ++y)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			max_depth = std::max(max_depth, lv.Depth[y * lv.Width + x]);
+		}
+	}
+	return nearestDepth > max_depth;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include "math/math.h"
+#include "pixel_buffer.h"
+
+// max-depth pyramid of a depth buffer, assumes a less (or less equal) depth test
+class HiZBuffer
+{
+public:
+	HiZBuffer() {}
+	~HiZBuffer() {}
+
+	void Build(const DepthBuffer& depthBuffer);
+	bool IsEmpty() const { return m_levels.empty(); }
+	int GetWidth() const { return m_width; }
+	int GetHeight() const { return m_height; }
+
+	// uv rect in [0, 1] (v goes down like the viewport), depth is the nearest depth of the tested object
+	bool IsOccluded(const float2& uvMin, const float2& uvMax, float nearestDepth) const;
+
+private:
+	struct Level
+	{
+		int Width;
+		int Height;
+		std::vector<float> Depth;
+	};
+	std::vector<Level> m_levels;
+	int m_width = 0;
+	int m_height = 0;
+};
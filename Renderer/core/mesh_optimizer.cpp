@@ -0,0 +1,489 @@
+#include "mesh_optimizer.h"
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+struct PositionKey
+{
+	uint32_t x, y, z;
+	bool operator==(const PositionKey& rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z; }
+};
+
+struct PositionKeyHasher
+{
+	size_t operator()(const PositionKey& key) const
+	{
+		return (key.x * 73856093u) ^ (key.y * 19349663u) ^ (key.z * 83492791u);
+	}
+};
+
+// symmetric 4x4 matrix, xx xy xz xw yy yz yw zz zw ww
+struct Quadric
+{
+	double a[10] = {};
+	void AddPlane(const float3& n, float d, float weight)
+	{
+		a[0] += weight * n.x * n.x; a[1] += weight * n.x * n.y; a[2] += weight * n.x * n.z; a[3] += weight * n.x * d;
+		a[4] += weight * n.y * n.y; a[5] += weight * n.y * n.z; a[6] += weight * n.y * d;
+		a[7] += weight * n.z * n.z; a[8] += weight * n.z * d;
+		a[9] += weight * d * d;
+	}
+	Quadric& operator+=(const Quadric& rhs)
+	{
+		for (int i = 0; i < 10; ++i)
+			a[i] += rhs.a[i];
+		return *this;
+	}
+	double Error(const float3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double r = a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x
+			+ a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y
+			+ a[7] * z * z + 2.0 * a[8] * z
+			+ a[9];
+		return r < 0.0 ? 0.0 : r;
+	}
+};
+
+struct Collapse
+{
+	uint32_t From;
+	uint32_t To;
+	float Error;
+};
+
+size_t VertexHasher::operator()(const Vertex& v) const
+{
+	uint32_t words[sizeof(Vertex) / sizeof(uint32_t)];
+	std::memcpy(words, &v, sizeof(Vertex));
+	size_t h = 2166136261u;
+	for (uint32_t w : words)
+	{
+		h = (h ^ w) * 16777619u;
+	}
+	return h;
+}
+
+bool VertexEqual::operator()(const Vertex& a, const Vertex& b) const
+{
+	return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+}
+
+float VertexCacheScore(int cachePosition, uint32_t liveTriangles)
+{
+	if (liveTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// the last triangle's vertices get a fixed score so the next triangle doesn't just reuse its edge
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = std::pow(1.0f - (float)(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3), 1.5f);
+	}
+	// boost vertices with few triangles left so they get finished off
+	score += 2.0f / std::sqrt((float)liveTriangles);
+	return score;
+}
+
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	size_t face_count = indexCount / 3;
+	if (face_count == 0)
+		return;
+
+	// vertex -> remaining triangles
+	std::vector<uint32_t> live(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; ++i)
+		live[indices[i]]++;
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + live[v];
+	std::vector<uint32_t> tri_list(indexCount);
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indexCount; ++i)
+			tri_list[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<int> cache_pos(vertexCount, -1);
+	std::vector<float> vertex_score(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertex_score[v] = VertexCacheScore(-1, live[v]);
+	std::vector<float> tri_score(face_count);
+	std::vector<uint8_t> emitted(face_count, 0);
+	int best_tri = 0;
+	for (size_t t = 0; t < face_count; ++t)
+	{
+		tri_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		if (tri_score[t] > tri_score[best_tri])
+			best_tri = (int)t;
+	}
+
+	std::vector<uint32_t> result(indexCount);
+	uint32_t cache[VERTEX_CACHE_SIZE + 3];
+	uint32_t new_cache[VERTEX_CACHE_SIZE + 3];
+	int cache_count = 0;
+	size_t cursor = 0;
+	for (size_t emitted_count = 0; emitted_count < face_count; ++emitted_count)
+	{
+		// nothing in the cache has triangles left, take the next unemitted one
+		if (best_tri < 0)
+		{
+			while (emitted[cursor])
+				++cursor;
+			best_tri = (int)cursor;
+		}
+
+		const uint32_t* tri = &indices[best_tri * 3];
+		result[emitted_count * 3] = tri[0];
+		result[emitted_count * 3 + 1] = tri[1];
+		result[emitted_count * 3 + 2] = tri[2];
+		emitted[best_tri] = 1;
+
+		// drop the triangle from its vertices' lists
+		int new_count = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = tri[k];
+			uint32_t* list = &tri_list[offsets[v]];
+			for (uint32_t j = 0; j < live[v]; ++j)
+			{
+				if (list[j] == (uint32_t)best_tri)
+				{
+					list[j] = list[live[v] - 1];
+					break;
+				}
+			}
+			live[v]--;
+			new_cache[new_count++] = v;
+		}
+
+		// the triangle's vertices move to the front of the cache
+		for (int i = 0; i < cache_count; ++i)
+		{
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				new_cache[new_count++] = v;
+		}
+		for (int i = VERTEX_CACHE_SIZE; i < new_count; ++i)
+		{
+			cache_pos[new_cache[i]] = -1;
+			vertex_score[new_cache[i]] = VertexCacheScore(-1, live[new_cache[i]]);
+		}
+		cache_count = std::min(new_count, VERTEX_CACHE_SIZE);
+		for (int i = 0; i < cache_count; ++i)
+		{
+			cache[i] = new_cache[i];
+			cache_pos[cache[i]] = i;
+			vertex_score[cache[i]] = VertexCacheScore(i, live[cache[i]]);
+		}
+
+		// rescore the triangles around the cache and pick the best one
+		best_tri = -1;
+		float best_score = -1.0f;
+		for (int i = 0; i < new_count; ++i)
+		{
+			uint32_t v = new_cache[i];
+			for (uint32_t j = 0; j < live[v]; ++j)
+			{
+				uint32_t t = tri_list[offsets[v] + j];
+				tri_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+				if (tri_score[t] > best_score)
+				{
+					best_score = tri_score[t];
+					best_tri = (int)t;
+				}
+			}
+		}
+	}
+
+	std::memcpy(indices, result.data(), indexCount * sizeof(uint32_t));
+}
+
+void OptimizeVertexFetch(Vertex* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertexCount);
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t& r = remap[indices[i]];
+		if (r == UINT32_MAX)
+		{
+			r = (uint32_t)reordered.size();
+			reordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = r;
+	}
+	// unreferenced vertices go to the back
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		if (remap[v] == UINT32_MAX)
+			reordered.push_back(vertices[v]);
+	}
+	std::copy(reordered.begin(), reordered.end(), vertices);
+}
+
+uint64_t EdgeKey(uint32_t a, uint32_t b)
+{
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+bool SameUV(const Vertex& a, const Vertex& b)
+{
+	return a.uv.x == b.uv.x && a.uv.y == b.uv.y;
+}
+
+void SimplifyMesh(const Vertex* vertices, size_t vertexCount, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, bool preserveSeams, std::vector<uint32_t>& result)
+{
+	// weld by position, the topology lives on positions while triangles keep pointing at vertices
+	std::vector<uint32_t> pos_ids(vertexCount);
+	std::vector<uint32_t> first_vertex;
+	{
+		std::unordered_map<PositionKey, uint32_t, PositionKeyHasher> pos_map;
+		pos_map.reserve(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			PositionKey key;
+			std::memcpy(&key, &vertices[v].position, sizeof(PositionKey));
+			auto iter = pos_map.insert({ key, (uint32_t)first_vertex.size() });
+			if (iter.second)
+				first_vertex.push_back((uint32_t)v);
+			pos_ids[v] = iter.first->second;
+		}
+	}
+	size_t num_pos = first_vertex.size();
+
+	std::vector<Quadric> quadrics(num_pos);
+	std::unordered_map<uint64_t, int> edge_count;
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			edge_count[EdgeKey(pos_ids[indices[i + k]], pos_ids[indices[i + (k + 1) % 3]])]++;
+		}
+	}
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const float3& p0 = vertices[indices[i]].position;
+		float3 n = Cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+		float area = (float)n.Length();
+		if (area == 0.0f)
+			continue;
+		n = n / area;
+		float d = -Dot(n, p0);
+		for (int k = 0; k < 3; ++k)
+		{
+			quadrics[pos_ids[indices[i + k]]].AddPlane(n, d, 1.0f);
+		}
+		// keep open borders in place with a plane perpendicular to the triangle through the border edge
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t a = pos_ids[indices[i + k]];
+			uint32_t b = pos_ids[indices[i + (k + 1) % 3]];
+			if (edge_count[EdgeKey(a, b)] != 1)
+				continue;
+			float3 edge = vertices[indices[i + (k + 1) % 3]].position - vertices[indices[i + k]].position;
+			float3 border_n = Normalize(Cross(edge, n));
+			float border_d = -Dot(border_n, vertices[indices[i + k]].position);
+			quadrics[a].AddPlane(border_n, border_d, 1.0f);
+			quadrics[b].AddPlane(border_n, border_d, 1.0f);
+		}
+	}
+
+	std::vector<uint32_t> triangles = indices;
+	std::vector<uint32_t> tri_offsets(num_pos + 1);
+	std::vector<uint32_t> tri_list;
+	std::vector<Collapse> collapses;
+	std::vector<uint8_t> locked(num_pos);
+	std::vector<uint8_t> border(num_pos);
+	std::vector<uint8_t> touched(num_pos);
+	std::vector<uint32_t> collapse_to(num_pos);
+	std::vector<uint32_t> vertex_remap(vertexCount);
+	std::vector<uint32_t> edge_tris;
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertex_remap[v] = (uint32_t)v;
+	while (triangles.size() > targetIndexCount)
+	{
+		// position -> triangles adjacency
+		std::fill(tri_offsets.begin(), tri_offsets.end(), 0);
+		for (uint32_t v : triangles)
+			tri_offsets[pos_ids[v] + 1]++;
+		for (size_t p = 0; p < num_pos; ++p)
+			tri_offsets[p + 1] += tri_offsets[p];
+		tri_list.resize(triangles.size());
+		{
+			std::vector<uint32_t> fill(tri_offsets.begin(), tri_offsets.end() - 1);
+			for (size_t i = 0; i < triangles.size(); ++i)
+				tri_list[fill[pos_ids[triangles[i]]]++] = (uint32_t)(i / 3);
+		}
+
+		// border positions may only slide along their border, non manifold ones stay
+		edge_count.clear();
+		for (size_t i = 0; i < triangles.size(); i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+				edge_count[EdgeKey(pos_ids[triangles[i + k]], pos_ids[triangles[i + (k + 1) % 3]])]++;
+		}
+		std::fill(locked.begin(), locked.end(), 0);
+		std::fill(border.begin(), border.end(), 0);
+		for (auto& edge : edge_count)
+		{
+			uint8_t* flags = edge.second == 1 ? border.data() : edge.second > 2 ? locked.data() : nullptr;
+			if (flags != nullptr)
+			{
+				flags[edge.first >> 32] = 1;
+				flags[edge.first & 0xFFFFFFFF] = 1;
+			}
+		}
+
+		// every half edge is a candidate to collapse its first position onto the second
+		collapses.clear();
+		for (size_t i = 0; i < triangles.size(); i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t from = pos_ids[triangles[i + k]];
+				uint32_t to = pos_ids[triangles[i + (k + 1) % 3]];
+				if (locked[from] || (border[from] && edge_count[EdgeKey(from, to)] != 1))
+					continue;
+				Quadric q = quadrics[from];
+				q += quadrics[to];
+				collapses.push_back({ from, to, (float)q.Error(vertices[first_vertex[to]].position) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.Error < b.Error; });
+
+		std::fill(touched.begin(), touched.end(), 0);
+		for (size_t p = 0; p < num_pos; ++p)
+			collapse_to[p] = (uint32_t)p;
+
+		size_t triangles_left = triangles.size() / 3;
+		size_t num_collapsed = 0;
+		for (const Collapse& c : collapses)
+		{
+			if (triangles_left * 3 <= targetIndexCount || c.Error > maxError)
+				break;
+			if (touched[c.From] || touched[c.To])
+				continue;
+
+			// triangles on the collapsed edge, they vanish and give the attributes at the target
+			edge_tris.clear();
+			for (uint32_t j = tri_offsets[c.From]; j < tri_offsets[c.From + 1]; ++j)
+			{
+				const uint32_t* tri = &triangles[tri_list[j] * 3];
+				if (pos_ids[tri[0]] == c.To || pos_ids[tri[1]] == c.To || pos_ids[tri[2]] == c.To)
+					edge_tris.push_back(tri_list[j]);
+			}
+
+			// every uv wedge at the source needs a matching wedge along the edge unless seams may tear,
+			// and no neighbouring triangle may flip
+			bool valid = true;
+			for (uint32_t j = tri_offsets[c.From]; j < tri_offsets[c.From + 1] && valid; ++j)
+			{
+				const uint32_t* tri = &triangles[tri_list[j] * 3];
+				int from_corner = pos_ids[tri[0]] == c.From ? 0 : pos_ids[tri[1]] == c.From ? 1 : 2;
+				uint32_t from_vertex = tri[from_corner];
+				bool matched = false;
+				for (uint32_t t : edge_tris)
+				{
+					const uint32_t* edge_tri = &triangles[t * 3];
+					for (int k = 0; k < 3 && !matched; ++k)
+					{
+						if (pos_ids[edge_tri[k]] == c.From && SameUV(vertices[edge_tri[k]], vertices[from_vertex]))
+						{
+							for (int l = 0; l < 3; ++l)
+							{
+								if (pos_ids[edge_tri[l]] == c.To)
+									vertex_remap[from_vertex] = edge_tri[l];
+							}
+							matched = true;
+						}
+					}
+				}
+				if (!matched)
+				{
+					if (preserveSeams || edge_tris.empty())
+					{
+						valid = false;
+						break;
+					}
+					// tear the seam, the wedge takes the attributes of the first triangle on the edge
+					const uint32_t* edge_tri = &triangles[edge_tris[0] * 3];
+					for (int l = 0; l < 3; ++l)
+					{
+						if (pos_ids[edge_tri[l]] == c.To)
+							vertex_remap[from_vertex] = edge_tri[l];
+					}
+				}
+
+				uint32_t p[3];
+				for (int k = 0; k < 3; ++k)
+					p[k] = collapse_to[pos_ids[tri[k]]];
+				if (p[0] == c.To || p[1] == c.To || p[2] == c.To)
+					continue;
+				const float3& p0 = vertices[first_vertex[p[0]]].position;
+				const float3& p1 = vertices[first_vertex[p[1]]].position;
+				const float3& p2 = vertices[first_vertex[p[2]]].position;
+				float3 n_old = Cross(p1 - p0, p2 - p0);
+				p[from_corner] = c.To;
+				const float3& q0 = vertices[first_vertex[p[0]]].position;
+				const float3& q1 = vertices[first_vertex[p[1]]].position;
+				const float3& q2 = vertices[first_vertex[p[2]]].position;
+				float3 n_new = Cross(q1 - q0, q2 - q0);
+				if (Dot(n_old, n_new) <= 0.0f)
+					valid = false;
+			}
+			if (!valid)
+			{
+				for (uint32_t j = tri_offsets[c.From]; j < tri_offsets[c.From + 1]; ++j)
+				{
+					const uint32_t* tri = &triangles[tri_list[j] * 3];
+					for (int k = 0; k < 3; ++k)
+					{
+						if (pos_ids[tri[k]] == c.From)
+							vertex_remap[tri[k]] = tri[k];
+					}
+				}
+				continue;
+			}
+
+			collapse_to[c.From] = c.To;
+			quadrics[c.To] += quadrics[c.From];
+			touched[c.From] = 1;
+			touched[c.To] = 1;
+			triangles_left -= std::min(edge_tris.size(), triangles_left);
+			++num_collapsed;
+		}
+
+		if (num_collapsed == 0)
+			break;
+
+		// rebuild triangles, dropping the degenerate ones
+		size_t write = 0;
+		for (size_t i = 0; i < triangles.size(); i += 3)
+		{
+			uint32_t tri[3];
+			for (int k = 0; k < 3; ++k)
+				tri[k] = vertex_remap[triangles[i + k]];
+			uint32_t p0 = pos_ids[tri[0]], p1 = pos_ids[tri[1]], p2 = pos_ids[tri[2]];
+			if (p0 == p1 || p1 == p2 || p2 == p0)
+				continue;
+			triangles[write++] = tri[0];
+			triangles[write++] = tri[1];
+			triangles[write++] = tri[2];
+		}
+		// vertices are shared between triangles, so the remap is only reset once all of them are rebuilt
+		for (size_t v = 0; v < vertexCount; ++v)
+			vertex_remap[v] = (uint32_t)v;
+		if (write == triangles.size())
+			break;
+		triangles.resize(write);
+	}
+
+	result.swap(triangles);
+}
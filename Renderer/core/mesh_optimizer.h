@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+#include "graphics.h"
+
+// bitwise vertex comparison for welding identical vertices with a hash map
+struct VertexHasher
+{
+	size_t operator()(const Vertex& v) const;
+};
+
+struct VertexEqual
+{
+	bool operator()(const Vertex& a, const Vertex& b) const;
+};
+
+// Forsyth's linear speed vertex cache optimization, reorders triangles in place
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// reorders vertices by first use and remaps the indices
+void OptimizeVertexFetch(Vertex* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// quadric error edge collapse, vertices only collapse onto existing vertices so all levels can share one vertex buffer.
+// open borders only collapse along themselves, uv seams too unless preserveSeams is false.
+// maxError is a squared world space distance
+void SimplifyMesh(const Vertex* vertices, size_t vertexCount, const std::vector<uint32_t>& indices, size_t targetIndexCount, float maxError, bool preserveSeams, std::vector<uint32_t>& result);
@@ -1,26 +1,227 @@
 #include "model.h"
+#include "hiz_buffer.h"
+#include "mesh_optimizer.h"
+#include "texture_cache.h"
 #include "utils/io_utils.h"
+#include "utils/mapped_file.h"
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <filesystem>
+#include <cstddef>
 
-Material::~Material()
+// obj files are split into newline aligned chunks of at least this size, parsed in parallel
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+// a streamed window grows up to this many times its size to fit a long line, longer lines are skipped
+#define OBJ_MAX_WINDOW_GROWTH 16
+// missing face tex coords and normals, past the end of any stream and without the relative index bit
+#define OBJ_MISSING_INDEX 0x7FFFFFFFu
+#define WELD_MIN_SLOTS 1024
+#define WELD_EMPTY_SLOT 0xFFFFFFFFu
+#define MESH_CACHE_EXTENSION ".meshcache"
+#define MESH_CACHE_MAGIC 0x4348534D
+// bump when the cache layout or the way models are built changes
+#define MESH_CACHE_VERSION 1
+
+enum eOBJCommand
 {
-	if (pAmbientMap != nullptr)
-		delete pAmbientMap;
-	if (pSpecularMap != nullptr)
-		delete pSpecularMap;
-}
+	OBJ_Command_Group,
+	OBJ_Command_Use_Material,
+	OBJ_Command_Material_Lib
+};
+
+// what a read of the obj is for, a streamed obj is read once for each of the last three
+enum eOBJPass
+{
+	// the streams and the faces, the model is built from them afterwards
+	OBJ_Pass_Store,
+	// the streams and the index count of every mesh
+	OBJ_Pass_Streams,
+	OBJ_Pass_Tangents,
+	OBJ_Pass_Build
+};
 
-Mesh::~Mesh()
+// the cache is valid while the obj has the same size and time, or the same contents after a copy
+struct MeshCacheHeader
 {
-	if (pMat != nullptr) 
-		delete pMat; 
-	for (auto face : pFaces)
+	uint32_t Magic;
+	uint32_t Version;
+	// layout of the records stored as they are in memory
+	uint32_t VertexSize;
+	uint32_t MeshletSize;
+	uint64_t SourceSize;
+	int64_t SourceTime;
+	uint64_t SourceHash;
+};
+
+// reads a mapped mesh cache front to back, Failed is set instead of reading past the end
+struct MeshCacheReader
+{
+	const char* Cur;
+	const char* End;
+	bool Failed = false;
+
+	void Read(void* data, size_t size)
 	{
-		if (face != nullptr)
-			delete face;
+		if (Failed || (size_t)(End - Cur) < size)
+		{
+			Failed = true;
+			return;
+		}
+		std::memcpy(data, Cur, size);
+		Cur += size;
 	}
-}
+	template <typename T>
+	void Read(T& value)
+	{
+		Read(&value, sizeof(T));
+	}
+	template <typename T>
+	void Read(std::vector<T>& values)
+	{
+		uint64_t count = 0;
+		Read(count);
+		if (Failed || count > (size_t)(End - Cur) / sizeof(T))
+		{
+			Failed = true;
+			return;
+		}
+		values.resize((size_t)count);
+		Read(values.data(), (size_t)count * sizeof(T));
+	}
+	void Read(std::string& text)
+	{
+		uint32_t length = 0;
+		Read(length);
+		if (Failed || length > (size_t)(End - Cur))
+		{
+			Failed = true;
+			return;
+		}
+		text.assign(Cur, length);
+		Cur += length;
+	}
+};
+
+struct MeshCacheWriter
+{
+	std::ofstream& Stream;
+
+	void Write(const void* data, size_t size)
+	{
+		Stream.write((const char*)data, size);
+	}
+	template <typename T>
+	void Write(const T& value)
+	{
+		Write(&value, sizeof(T));
+	}
+	template <typename T>
+	void Write(const std::vector<T>& values)
+	{
+		Write((uint64_t)values.size());
+		Write(values.data(), values.size() * sizeof(T));
+	}
+	void Write(const std::string& text)
+	{
+		Write((uint32_t)text.size());
+		Write(text.data(), text.size());
+	}
+};
+
+// welds the identical vertices of one mesh, the slots index the mesh's vertices instead of holding copies of them
+struct VertexWeldTable
+{
+	std::vector<uint32_t> Slots;
+	uint32_t Count = 0;
+
+	void Clear()
+	{
+		Slots.clear();
+		Count = 0;
+	}
+	// index of the vertex equal to v, Count - 1 if it's new and has to be added to vertices
+	uint32_t Insert(const Vertex& v, const Vertex* vertices)
+	{
+		if (((size_t)Count + 1) * 2 > Slots.size())
+			Grow(vertices);
+		size_t mask = Slots.size() - 1;
+		for (size_t slot = VertexHasher()(v) & mask;; slot = (slot + 1) & mask)
+		{
+			if (Slots[slot] == WELD_EMPTY_SLOT)
+			{
+				Slots[slot] = Count;
+				return Count++;
+			}
+			if (VertexEqual()(vertices[Slots[slot]], v))
+				return Slots[slot];
+		}
+	}
+	void Grow(const Vertex* vertices)
+	{
+		std::vector<uint32_t> slots(std::max(Slots.size() * 2, (size_t)WELD_MIN_SLOTS), WELD_EMPTY_SLOT);
+		size_t mask = slots.size() - 1;
+		for (uint32_t i = 0; i < Count; ++i)
+		{
+			size_t slot = VertexHasher()(vertices[i]) & mask;
+			while (slots[slot] != WELD_EMPTY_SLOT)
+				slot = (slot + 1) & mask;
+			slots[slot] = i;
+		}
+		Slots.swap(slots);
+	}
+};
+
+// the vertex data of an obj, the faces index it
+struct OBJStreams
+{
+	std::vector<float3> Positions;
+	std::vector<float3> Colors;
+	std::vector<float2> TexCoords;
+	std::vector<float3> Normals;
+	// per position, summed over the faces around it until they're normalized
+	std::vector<float3> SmoothedNormals;
+	std::vector<float3> Tangents;
+	std::vector<float3> Bitangents;
+};
+
+// one mesh while its faces are added
+struct MeshBuilder
+{
+	Mesh* pMesh = nullptr;
+	std::vector<Vertex> Vertices;
+	VertexWeldTable WeldTable;
+	// where the next triangle goes in the index buffer
+	size_t IndexLocation = 0;
+};
+
+// what one chunk of an obj file parses to, chunks are merged in file order
+struct OBJChunk
+{
+	// g, usemtl and mtllib lines, applied to the faces from FaceStart on
+	struct Command
+	{
+		eOBJCommand Type;
+		std::string Name;
+		size_t FaceStart;
+	};
+	// negative indices count back from the end of their stream, the chunk only knows its own part of it.
+	// faces keep them as they are, the top bit tells them from real indices, and the merge resolves them
+	struct RelativeFace
+	{
+		uint32_t Face;
+		// positions, tex coords and normals of the chunk before the face
+		uint32_t StreamSizes[3];
+	};
+
+	std::vector<float3> Positions;
+	std::vector<float3> Colors;
+	std::vector<float2> TexCoords;
+	std::vector<float3> Normals;
+	FaceList Faces;
+	std::vector<Command> Commands;
+	std::vector<RelativeFace> RelativeFaces;
+};
 
 Model::~Model()
 {
@@ -41,131 +242,335 @@ Model::~Model()
 	}
 }
 
-void GetVertexInfo(const std::string& dataBuffer, size_t& idx, size_t end, std::vector<float3>& positions, std::vector<float3>& colors, std::vector<float2>& texCoords, std::vector<float3>& normals);
-void GetFaceInfo(const std::string& dataBuffer, size_t& idx, size_t end, const std::string& filename, const std::string& meshName, Mesh*& pCurMesh, std::unordered_map<std::string, Mesh*>& meshMap, size_t& modelIndexCount, size_t numPositions, size_t numTexCoords, size_t numNormals);
-void SetMaterial(const std::string& dataBuffer, size_t& idx, size_t end, std::unordered_map<std::string, Material*>& matMap, Mesh* pCurMesh);
-void GetMaterialLib(const std::string& dataBuffer, size_t& idx, size_t end, const std::string& path, std::unordered_map<std::string, Material*>& matMap, Material*& pCurMat);
+void ParseOBJChunk(const char* begin, const char* end, const std::string& filename, OBJChunk& chunk);
+void GetVertexInfo(const char* iter, const char* end, OBJChunk& chunk);
+void GetFaceInfo(const char* iter, const char* end, const std::string& filename, OBJChunk& chunk);
+std::string GetCommandName(const char* iter, const char* end, const char* command);
+void AddTangentFrame(const FaceCorner* corners, uint32_t cornerCount, OBJStreams& streams);
+void NormalizeTangentFrames(OBJStreams& streams);
+void SetMaterial(const std::string& matName, std::unordered_map<std::string, Material*>& matMap, Mesh* pCurMesh);
+void GetMaterialLib(const std::string& filename, const std::string& path, std::unordered_map<std::string, Material*>& matMap, Material*& pCurMat, const ModelLoadDesc& desc);
+void GetFrustumPlanes(const float4x4& viewProj, float4 planes[6]);
+bool IsMeshletCulled(const Meshlet& meshlet, const ModelViewDesc& viewDesc, const float4 planes[6], float coneSign, const Viewport* viewport);
+float3 GetQuantizationScale(const BoundingBox3D& bbox);
+bool GetSourceKey(const std::string& filename, uint64_t& size, int64_t& time);
+uint64_t HashFile(const std::string& filename);
 
-void Model::LoadFromOBJ(const std::string& filename)
+void Model::LoadFromOBJ(const std::string& filename, const ModelLoadDesc& desc /* = ModelLoadDesc() */)
 {
-	std::ifstream fs;
-	fs.open(filename);
-	if (!fs.is_open())
+	std::string cache_filename = filename + MESH_CACHE_EXTENSION;
+	if (desc.MeshCache && LoadMeshCache(cache_filename, filename, desc))
+	{
+		if (desc.PackVertices || desc.SplitStreams)
+			BuildVertexStreams(desc.PackVertices, desc.SplitStreams);
+		return;
+	}
+
+	bool streaming = desc.StreamWindowSize > 0;
+	MappedFile file;
+	std::ifstream stream;
+	if (streaming)
+		stream.open(filename, std::ios::binary);
+	if (streaming ? !stream.is_open() : !file.Open(filename))
 	{
 		std::cout << "failed to open " << filename << "\n";
+		return;
 	}
-	else
+
+	OBJStreams streams;
+	std::unordered_map<Mesh*, MeshBuilder> builders;
+	Mesh* cur_mesh = nullptr;
+	Material* cur_mat = nullptr;
+	auto model_name_start = filename.find_last_of('/') + 1;
+	auto model_name_end = filename.find_last_of('.');
+	std::string model_name = filename.substr(model_name_start, model_name_end - model_name_start);
+	std::string mesh_name = model_name;
+	std::string path = filename.substr(0, model_name_start);
+	std::vector<std::string> material_libs;
+	// positions, tex coords and normals read so far, the streams themselves are only filled by the first read
+	uint32_t stream_sizes[3] = {};
+	auto get_mesh = [&]()
 	{
-		// read whole file
-		std::string data_buffer((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
-		fs.close();
-
-		size_t line_beg = 0;
-		size_t line_end = FindLineEnd(data_buffer, line_beg);
-
-		std::vector<float3> positions;
-		std::vector<float3> colors;
-		std::vector<float2> texture_coords;
-		std::vector<float3> normals;
-		Mesh* cur_mesh = nullptr;
-		Material* cur_mat = nullptr;
-		auto model_name_start = filename.find_last_of('/') + 1;
-		auto model_name_end = filename.find_last_of('.');
-		std::string model_name = filename.substr(model_name_start, model_name_end - model_name_start);
-		std::string mesh_name = model_name;
-		std::string path = filename.substr(0, model_name_start);
-
-		while (line_beg < data_buffer.size())
-		{
-			size_t iter = line_beg;
-			switch (data_buffer[iter])
-			{
-			// get vertex position, (color), (texture coordinate), and normal
-			case 'v':
+		auto mesh_iter = m_pMeshes.find(mesh_name);
+		if (mesh_iter != m_pMeshes.end())
+			return mesh_iter->second;
+		Mesh* mesh = new Mesh(mesh_name);
+		m_pMeshes.insert({ mesh_name, mesh });
+		return mesh;
+	};
+	// grows geometrically, windows add a little at a time
+	auto reserve_more = [](auto& values, size_t count)
+	{
+		if (values.capacity() < values.size() + count)
+			values.reserve(std::max(values.size() + count, values.capacity() * 2));
+	};
+
+	// the whole file or one window of it, the state of the merge carries over to the next window
+	auto parse_window = [&](const char* data, size_t size, eOBJPass pass)
+	{
+		// chunks end after a newline, so no line is split
+		size_t max_chunks = std::max((size_t)std::thread::hardware_concurrency(), (size_t)1) * 4;
+		size_t chunk_count = std::clamp(size / OBJ_MIN_CHUNK_SIZE, (size_t)1, max_chunks);
+		std::vector<const char*> chunk_bounds(chunk_count + 1, data + size);
+		chunk_bounds[0] = data;
+		for (size_t i = 1; i < chunk_count; ++i)
+		{
+			const char* bound = std::max(data + size / chunk_count * i, chunk_bounds[i - 1]);
+			const char* line_end = (const char*)std::memchr(bound, '\n', data + size - bound);
+			chunk_bounds[i] = line_end != nullptr ? line_end + 1 : data + size;
+		}
+		std::vector<OBJChunk> chunks(chunk_count);
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)chunk_count; ++i)
+		{
+			ParseOBJChunk(chunk_bounds[i], chunk_bounds[i + 1], filename, chunks[i]);
+		}
+
+		bool first_read = pass == OBJ_Pass_Store || pass == OBJ_Pass_Streams;
+		if (first_read)
+		{
+			size_t num_positions = 0;
+			size_t num_colors = 0;
+			size_t num_tex_coords = 0;
+			size_t num_normals = 0;
+			for (const OBJChunk& chunk : chunks)
 			{
-				iter++;
-				GetVertexInfo(data_buffer, iter, line_end, positions, colors, texture_coords, normals);
+				num_positions += chunk.Positions.size();
+				num_colors += chunk.Colors.size();
+				num_tex_coords += chunk.TexCoords.size();
+				num_normals += chunk.Normals.size();
 			}
-			break;
+			reserve_more(streams.Positions, num_positions);
+			reserve_more(streams.Colors, num_colors);
+			reserve_more(streams.TexCoords, num_tex_coords);
+			reserve_more(streams.Normals, num_normals);
+		}
 
-			// get face
-			case 'f':
+		// merge in file order, the groups and relative indices of a chunk depend on the chunks before it
+		for (OBJChunk& chunk : chunks)
+		{
+			for (const OBJChunk::RelativeFace& relative : chunk.RelativeFaces)
 			{
-				++iter;
-				GetFaceInfo(data_buffer, iter, line_end, filename, mesh_name, cur_mesh, m_pMeshes, m_indexCount, positions.size(), texture_coords.size(), normals.size());
+				uint32_t corner_begin = relative.Face > 0 ? chunk.Faces.FaceEnds[relative.Face - 1] : 0;
+				for (uint32_t c = corner_begin; c < chunk.Faces.FaceEnds[relative.Face]; ++c)
+				{
+					FaceCorner& corner = chunk.Faces.Corners[c];
+					uint32_t* indices[3] = { &corner.Position, &corner.TexCoord, &corner.Normal };
+					for (int i = 0; i < 3; ++i)
+					{
+						if (*indices[i] & 0x80000000u)
+							*indices[i] = stream_sizes[i] + relative.StreamSizes[i] + (int32_t)*indices[i];
+					}
+				}
+			}
+			stream_sizes[0] += (uint32_t)chunk.Positions.size();
+			stream_sizes[1] += (uint32_t)chunk.TexCoords.size();
+			stream_sizes[2] += (uint32_t)chunk.Normals.size();
+			if (first_read)
+			{
+				streams.Positions.insert(streams.Positions.end(), chunk.Positions.begin(), chunk.Positions.end());
+				streams.Colors.insert(streams.Colors.end(), chunk.Colors.begin(), chunk.Colors.end());
+				streams.TexCoords.insert(streams.TexCoords.end(), chunk.TexCoords.begin(), chunk.TexCoords.end());
+				streams.Normals.insert(streams.Normals.end(), chunk.Normals.begin(), chunk.Normals.end());
 			}
-			break;
 
-			// get group and build group
-			case 'g':
+			size_t face_index = 0;
+			auto add_faces = [&](size_t faceEnd)
 			{
-				++iter;
-				SkipSpaces(data_buffer, iter);
-				auto name_end = iter;
-				while (name_end < line_end && !IsLineEnd(data_buffer[name_end]))
-					name_end++;
-				mesh_name = std::string(&data_buffer[iter], name_end - iter);
-				auto mesh_iter = m_pMeshes.find(mesh_name);
-				if (mesh_iter != m_pMeshes.end())
+				if (face_index == faceEnd)
+					return;
+				if (cur_mesh == nullptr)
+					cur_mesh = get_mesh();
+				const FaceList& faces = chunk.Faces;
+				uint32_t corner_begin = face_index > 0 ? faces.FaceEnds[face_index - 1] : 0;
+				if (pass == OBJ_Pass_Store)
 				{
-					cur_mesh = mesh_iter->second;
+					FaceList& mesh_faces = cur_mesh->Faces;
+					uint32_t corner_offset = (uint32_t)mesh_faces.Corners.size() - corner_begin;
+					for (size_t f = face_index; f < faceEnd; ++f)
+						mesh_faces.FaceEnds.push_back(faces.FaceEnds[f] + corner_offset);
+					mesh_faces.Corners.insert(mesh_faces.Corners.end(), faces.Corners.begin() + corner_begin, faces.Corners.begin() + faces.FaceEnds[faceEnd - 1]);
 				}
-				else
+				MeshBuilder* builder = nullptr;
+				if (pass == OBJ_Pass_Build)
+					builder = &builders[cur_mesh];
+				for (; face_index < faceEnd; ++face_index)
 				{
-					cur_mesh = new Mesh(mesh_name);
-					m_pMeshes.insert({ mesh_name, cur_mesh });
+					uint32_t corner_count = faces.FaceEnds[face_index] - corner_begin;
+					const FaceCorner* corners = &faces.Corners[corner_begin];
+					corner_begin = faces.FaceEnds[face_index];
+					if (first_read)
+					{
+						cur_mesh->IndexCount += (corner_count - 2) * 3;
+						m_indexCount += (corner_count - 2) * 3;
+					}
+					else if (pass == OBJ_Pass_Tangents)
+					{
+						AddTangentFrame(corners, corner_count, streams);
+					}
+					else
+					{
+						AddFace(corners, corner_count, streams, *builder);
+					}
 				}
-			}
-			break;
-
-			// set group material
-			case 'u':
+			};
+			for (const OBJChunk::Command& command : chunk.Commands)
 			{
-				auto cmd_end = iter;
-				while (cmd_end < line_end && data_buffer[cmd_end] != ' ')
-					cmd_end++;
-				std::string cmd(&data_buffer[iter], cmd_end - iter);
-				if (cmd == "usemtl")
+				add_faces(command.FaceStart);
+				switch (command.Type)
 				{
-					iter = cmd_end;
-					SkipSpaces(data_buffer, iter);
-					SetMaterial(data_buffer, iter, line_end, m_pMaterials, cur_mesh);
+				case OBJ_Command_Group:
+					mesh_name = command.Name;
+					cur_mesh = get_mesh();
+					break;
+				case OBJ_Command_Use_Material:
+					if (cur_mesh == nullptr)
+						cur_mesh = get_mesh();
+					if (first_read)
+						SetMaterial(command.Name, m_pMaterials, cur_mesh);
+					break;
+				case OBJ_Command_Material_Lib:
+					if (first_read)
+					{
+						GetMaterialLib(command.Name, path, m_pMaterials, cur_mat, desc);
+						material_libs.push_back(command.Name);
+					}
+					break;
 				}
 			}
-			break;
+			add_faces(chunk.Faces.FaceEnds.size());
+			chunk = OBJChunk();
+		}
+	};
 
-			// get material info
-			case 'm':
+	std::vector<char> window(desc.StreamWindowSize);
+	size_t max_window_size = desc.StreamWindowSize * OBJ_MAX_WINDOW_GROWTH;
+	auto read_file = [&](eOBJPass pass)
+	{
+		cur_mesh = nullptr;
+		mesh_name = model_name;
+		std::fill(std::begin(stream_sizes), std::end(stream_sizes), 0);
+		if (!streaming)
+		{
+			parse_window(file.GetData(), file.GetSize(), pass);
+			return;
+		}
+
+		// windows end after their last newline, the partial line moves to the front of the next one
+		stream.clear();
+		stream.seekg(0);
+		size_t carried = 0;
+		bool skipping = false;
+		while (true)
+		{
+			stream.read(window.data() + carried, window.size() - carried);
+			size_t size = carried + (size_t)stream.gcount();
+			bool last = !stream;
+			if (skipping)
+			{
+				// the overlong line is dropped up to its newline, the rest is parsed as usual
+				const char* line_end = (const char*)std::memchr(window.data(), '\n', size);
+				size_t dropped = line_end != nullptr ? line_end + 1 - window.data() : size;
+				size -= dropped;
+				std::memmove(window.data(), window.data() + dropped, size);
+				skipping = line_end == nullptr;
+				carried = size;
+				if (skipping && last)
+					break;
+				if (!last)
+					continue;
+			}
+			size_t parse_size = size;
+			if (!last)
 			{
-				auto cmd_end = iter;
-				while (cmd_end < line_end && data_buffer[cmd_end] != ' ')
-					cmd_end++;
-				std::string cmd(&data_buffer[iter], cmd_end - iter);
-				if (cmd == "mtllib")
+				while (parse_size > 0 && window[parse_size - 1] != '\n')
+					--parse_size;
+				// a line longer than the window
+				if (parse_size == 0 && window.size() < max_window_size)
 				{
-					iter = cmd_end;
-					SkipSpaces(data_buffer, iter);
-					GetMaterialLib(data_buffer, iter, line_end, path, m_pMaterials, cur_mat);
+					window.resize(std::min(window.size() * 2, max_window_size));
+					carried = size;
+					continue;
+				}
+				if (parse_size == 0)
+				{
+					// every pass skips the same lines, it's reported once
+					if (pass == OBJ_Pass_Streams)
+						std::cout << "line longer than " << max_window_size << " bytes skipped in " << filename << std::endl;
+					skipping = true;
+					carried = 0;
+					continue;
 				}
 			}
-			break;
-
-			}
-
-			line_beg = 1 + (IsLineEnd(data_buffer[line_beg]) ? line_beg : line_end);
-			line_end = FindLineEnd(data_buffer, line_beg);
+			parse_window(window.data(), parse_size, pass);
+			carried = size - parse_size;
+			std::memmove(window.data(), window.data() + parse_size, carried);
+			if (last)
+				break;
 		}
+	};
 
-		// build tangents
-		std::vector<float3> smoothed_normals(positions.size(), float3(0.0, 0.0, 0.0));
-		std::vector<float3> tangents(positions.size(), float3(0.0, 0.0, 0.0));
-		std::vector<float3> bitangents(positions.size(), float3(0.0, 0.0, 0.0));
-		SmoothNormalAndBuildTangents(positions, texture_coords, normals, smoothed_normals, tangents, bitangents);
-
-		// build mesh
-		BuildModel(positions, colors, texture_coords, smoothed_normals, tangents, bitangents);
+	// a streamed obj is read again for the tangents and the triangles instead of keeping its faces,
+	// a vertex's smoothed normal and tangents depend on every face around it
+	read_file(streaming ? OBJ_Pass_Streams : OBJ_Pass_Store);
+	file.Close();
+	streams.SmoothedNormals.assign(streams.Positions.size(), float3(0.0, 0.0, 0.0));
+	streams.Tangents.assign(streams.Positions.size(), float3(0.0, 0.0, 0.0));
+	streams.Bitangents.assign(streams.Positions.size(), float3(0.0, 0.0, 0.0));
+	if (streaming)
+	{
+		if (!streams.TexCoords.empty())
+			read_file(OBJ_Pass_Tangents);
+		NormalizeTangentFrames(streams);
+	}
+	else
+	{
+		SmoothNormalAndBuildTangents(streams);
+	}
+	std::vector<float3>().swap(streams.Normals);
 
+	// every mesh writes its triangles to its own range, in whatever order its faces come
+	m_indexBuffer.resize(m_indexCount);
+	size_t index_location = 0;
+	for (auto& mesh_pair : m_pMeshes)
+	{
+		mesh_pair.second->IndexStartLocation = index_location;
+		index_location += mesh_pair.second->IndexCount;
+	}
+	if (streaming)
+	{
+		for (auto& mesh_pair : m_pMeshes)
+		{
+			MeshBuilder& builder = builders[mesh_pair.second];
+			builder.pMesh = mesh_pair.second;
+			builder.IndexLocation = mesh_pair.second->IndexStartLocation;
+		}
+		read_file(OBJ_Pass_Build);
+		streams = OBJStreams();
+		size_t vertex_count = 0;
+		for (auto& builder : builders)
+		{
+			builder.second.WeldTable = VertexWeldTable();
+			vertex_count += builder.second.Vertices.size();
+		}
+		m_vertexBuffer.reserve(vertex_count);
+		for (auto& mesh_pair : m_pMeshes)
+			FinishMesh(builders[mesh_pair.second]);
+	}
+	else
+	{
+		BuildModel(streams);
+		streams = OBJStreams();
 	}
+	builders.clear();
+
+	BuildLODs();
+	BuildMeshlets();
+	CompactIndices();
+	if (desc.MeshCache)
+		SaveMeshCache(cache_filename, filename, material_libs);
+	if (desc.PackVertices || desc.SplitStreams)
+		BuildVertexStreams(desc.PackVertices, desc.SplitStreams);
 }
 
 void Model::CreateAsQuad()
@@ -200,163 +605,521 @@ void Model::CreateAsQuad()
 	mesh->IndexCount = 6;
 	mesh->IndexStartLocation = 0;
 	mesh->VertexStartLocation = 0;
+	mesh->VertexCount = 4;
 
 	m_pMeshes.insert({ mesh->Name, mesh });
 }
 
-void Model::SmoothNormalAndBuildTangents(std::vector<float3>& positions, std::vector<float2>& texCoords, std::vector<float3>& normals, std::vector<float3>& smoothedNormals, std::vector<float3>& tangents, std::vector<float3>& bitangents)
+void Model::SmoothNormalAndBuildTangents(OBJStreams& streams)
 {
-	for (auto& mesh_pair : m_pMeshes)
+	if (!streams.TexCoords.empty())
 	{
-		Mesh* pMesh = mesh_pair.second;
-		for (Face* pFace : pMesh->pFaces)
-		{
-			std::vector<uint32_t> indices(pFace->Positions.size());
-			std::vector<float3> p(pFace->Positions.size());
-			std::vector<float2> uv(pFace->Positions.size());
-			std::vector<float3> n(pFace->Positions.size());
-			// init
-			for (int i = 0; i < pFace->Positions.size(); ++i)
+		for (auto& mesh_pair : m_pMeshes)
+		{
+			const FaceList& faces = mesh_pair.second->Faces;
+			uint32_t face_begin = 0;
+			for (uint32_t face_end : faces.FaceEnds)
 			{
-				indices[i] = pFace->Positions[i];
-				p[i] = positions[pFace->Positions[i]];
-				if (!texCoords.empty())
-					uv[i] = texCoords[pFace->TexCoords[i]];
-				n[i] = normals[pFace->Normals[i]];
+				AddTangentFrame(&faces.Corners[face_begin], face_end - face_begin, streams);
+				face_begin = face_end;
 			}
+		}
+	}
+	NormalizeTangentFrames(streams);
+}
 
-			if (texCoords.empty())
-				continue;
+void Model::BuildModel(const OBJStreams& streams)
+{
+	m_vertexBuffer.clear();
+	m_vertexBuffer.reserve(streams.Positions.size());
+	MeshBuilder builder;
+	for (auto& mesh_pair : m_pMeshes)
+	{
+		Mesh* pMesh = mesh_pair.second;
+		builder.pMesh = pMesh;
+		builder.IndexLocation = pMesh->IndexStartLocation;
+		builder.WeldTable.Clear();
+		uint32_t face_begin = 0;
+		for (uint32_t face_end : pMesh->Faces.FaceEnds)
+		{
+			AddFace(&pMesh->Faces.Corners[face_begin], face_end - face_begin, streams, builder);
+			face_begin = face_end;
+		}
+		pMesh->Faces = FaceList();
+		FinishMesh(builder);
+	}
+}
 
-			for (int i = 0; i < pFace->Positions.size() - 2; ++i)
-			{
-				auto i0 = indices[0];
-				auto i1 = indices[i + 1];
-				auto i2 = indices[i + 2];
-				const auto& p0 = p[0];
-				const auto& p1 = p[i + 1];
-				const auto& p2 = p[i + 2];
-				const auto& uv0 = uv[0];
-				const auto& uv1 = uv[i + 1];
-				const auto& uv2 = uv[i + 2];
-
-				float3 e1 = p1 - p0, e2 = p2 - p0;
-				float x1 = uv1.x - uv0.x, x2 = uv2.x - uv0.x;
-				float y1 = uv2.y - uv0.y, y2 = uv2.y - uv0.y;
-
-				float r = 1.0f / std::max((x1 * y2 - x2 * y1), 0.00001f);
-				float3 t = (e1 * y2 - e2 * y1) * r;
-				float3 b = (e2 * x1 - e1 * x2) * r;
-
-				tangents[i0] += t;
-				tangents[i1] += t;
-				tangents[i2] += t;
-
-				bitangents[i0] += b;
-				bitangents[i1] += b;
-				bitangents[i2] += b;
-
-				smoothedNormals[i0] += n[0];
-				smoothedNormals[i1] += n[i + 1];
-				smoothedNormals[i2] += n[i + 2];
-			}
+void Model::AddFace(const FaceCorner* corners, uint32_t cornerCount, const OBJStreams& streams, MeshBuilder& builder)
+{
+	// identical corners share one vertex, indices are relative to the mesh's first vertex
+	bool has_color_info = streams.Positions.size() == streams.Colors.size();
+	auto add_vertex = [&](const FaceCorner& corner) -> uint32_t
+	{
+		Vertex v;
+		v.position = streams.Positions[corner.Position];
+		v.color = has_color_info ? float4(streams.Colors[corner.Position], 1.0f) : float4(1.0, 1.0, 1.0, 1.0);
+		v.normal = streams.SmoothedNormals[corner.Position];
+		v.uv = corner.TexCoord < streams.TexCoords.size() ? streams.TexCoords[corner.TexCoord] : float2(0.0, 0.0);
+		v.tangent = streams.Tangents[corner.Position];
+		v.bitangent = streams.Bitangents[corner.Position];
+		uint32_t index = builder.WeldTable.Insert(v, builder.Vertices.data());
+		if (index == builder.Vertices.size())
+		{
+			builder.Vertices.push_back(v);
+			builder.pMesh->BBox.Min(v.position);
+			builder.pMesh->BBox.Max(v.position);
 		}
+		return index;
+	};
+
+	// triangle fan
+	uint32_t first = add_vertex(corners[0]);
+	uint32_t prev = add_vertex(corners[1]);
+	for (uint32_t i = 2; i < cornerCount; ++i)
+	{
+		uint32_t cur = add_vertex(corners[i]);
+		m_indexBuffer[builder.IndexLocation++] = first;
+		m_indexBuffer[builder.IndexLocation++] = prev;
+		m_indexBuffer[builder.IndexLocation++] = cur;
+		prev = cur;
 	}
+}
+
+void Model::FinishMesh(MeshBuilder& builder)
+{
+	Mesh* pMesh = builder.pMesh;
+	pMesh->VertexStartLocation = m_vertexBuffer.size();
+	pMesh->VertexCount = (uint32_t)builder.Vertices.size();
+	m_vertexBuffer.insert(m_vertexBuffer.end(), builder.Vertices.begin(), builder.Vertices.end());
+	std::vector<Vertex>().swap(builder.Vertices);
 
-	for (int i = 0; i < positions.size(); ++i)
+	// triangles in post transform cache order, then vertices in order of first use
+	uint32_t* indices = m_indexBuffer.data() + pMesh->IndexStartLocation;
+	OptimizeVertexCache(indices, pMesh->IndexCount, pMesh->VertexCount);
+	OptimizeVertexFetch(m_vertexBuffer.data() + pMesh->VertexStartLocation, indices, pMesh->IndexCount, pMesh->VertexCount);
+
+	m_bbox.Min(pMesh->BBox.BoxMin);
+	m_bbox.Max(pMesh->BBox.BoxMax);
+}
+
+void Model::BuildLODs()
+{
+	for (auto& mesh_pair : m_pMeshes)
 	{
-		smoothedNormals[i] = Normalize(smoothedNormals[i]);
-		const auto& n = smoothedNormals[i];
-		if (texCoords.empty())
-			continue;
-		const auto& t = tangents[i];
-		const auto& b = bitangents[i];
-		tangents[i] = Normalize(t - Dot(t, n) * n);
-		bitangents[i] = Normalize(b - Dot(b, n) * n - Dot(b, tangents[i]) * tangents[i]);
+		Mesh* pMesh = mesh_pair.second;
+		pMesh->LODs.clear();
+		pMesh->LODs.push_back({ (uint32_t)pMesh->IndexStartLocation, pMesh->IndexCount, 0, 0 });
+
+		const Vertex* vertices = m_vertexBuffer.data() + pMesh->VertexStartLocation;
+		float extent = (float)(pMesh->BBox.BoxMax - pMesh->BBox.BoxMin).Length();
+
+		// every level halves the triangles of the previous one and is allowed twice its error,
+		// levels drawn at a quarter of the full detail size or less may tear uv seams
+		std::vector<uint32_t> lod_indices(m_indexBuffer.begin() + pMesh->IndexStartLocation, m_indexBuffer.begin() + pMesh->IndexStartLocation + pMesh->IndexCount);
+		std::vector<uint32_t> simplified;
+		float max_error = extent * 0.005f;
+		for (int level = 1; level < MODEL_MAX_LODS; ++level)
+		{
+			max_error *= 2.0f;
+			size_t target_index_count = lod_indices.size() / 6 * 3;
+			SimplifyMesh(vertices, pMesh->VertexCount, lod_indices, target_index_count, max_error * max_error, level < 2, simplified);
+			// stop once the mesh doesn't get meaningfully smaller
+			if (simplified.empty() || simplified.size() * 10 > lod_indices.size() * 9)
+				break;
+
+			OptimizeVertexCache(simplified.data(), simplified.size(), pMesh->VertexCount);
+			pMesh->LODs.push_back({ (uint32_t)m_indexBuffer.size(), (uint32_t)simplified.size(), 0, 0 });
+			m_indexBuffer.insert(m_indexBuffer.end(), simplified.begin(), simplified.end());
+			lod_indices.swap(simplified);
+		}
 	}
 }
 
-void Model::BuildModel(std::vector<float3>& positions, std::vector<float3>& colors, std::vector<float2>& texCoords, std::vector<float3>& normals, std::vector<float3>& tangents, std::vector<float3>& bitangents)
+void Model::BuildMeshlets()
 {
-	m_indexBuffer.resize(m_indexCount);
-	m_vertexBuffer.resize(m_indexCount);
-	bool has_color_info = positions.size() == colors.size();
-	bool has_tex_coord_info = texCoords.size() > 0;
-	size_t cur_index_loc = 0;
-	size_t cur_vertex_loc = 0;
+	m_meshlets.clear();
+	for (auto& mesh_pair : m_pMeshes)
+	{
+		Mesh* pMesh = mesh_pair.second;
+		const Vertex* vertices = m_vertexBuffer.data() + pMesh->VertexStartLocation;
+		for (MeshLOD& lod : pMesh->LODs)
+		{
+			lod.MeshletStartLocation = (uint32_t)m_meshlets.size();
+			for (uint32_t first_index = 0; first_index < lod.IndexCount; first_index += MESHLET_MAX_TRIANGLES * 3)
+			{
+				Meshlet meshlet;
+				meshlet.IndexStartLocation = lod.IndexStartLocation + first_index;
+				meshlet.IndexCount = std::min<uint32_t>(MESHLET_MAX_TRIANGLES * 3, lod.IndexCount - first_index);
+				const uint32_t* indices = &m_indexBuffer[meshlet.IndexStartLocation];
+
+				// bounding sphere
+				BoundingBox3D bbox;
+				for (uint32_t i = 0; i < meshlet.IndexCount; ++i)
+				{
+					bbox.Min(vertices[indices[i]].position);
+					bbox.Max(vertices[indices[i]].position);
+				}
+				meshlet.Center = (bbox.BoxMin + bbox.BoxMax) * 0.5f;
+				float radius = 0.0f;
+				for (uint32_t i = 0; i < meshlet.IndexCount; ++i)
+				{
+					radius = std::max(radius, (float)(vertices[indices[i]].position - meshlet.Center).Length());
+				}
+				meshlet.Radius = radius;
+
+				// normal cone
+				float3 axis(0.0f);
+				for (uint32_t i = 0; i < meshlet.IndexCount; i += 3)
+				{
+					const float3& p0 = vertices[indices[i]].position;
+					float3 n = Cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+					if (n.LengthSquared() > 0.0)
+						axis += Normalize(n);
+				}
+				meshlet.ConeAxis = Normalize(axis);
+				float min_dp = axis.LengthSquared() > 0.0 ? 1.0f : -1.0f;
+				for (uint32_t i = 0; i < meshlet.IndexCount; i += 3)
+				{
+					const float3& p0 = vertices[indices[i]].position;
+					float3 n = Cross(vertices[indices[i + 1]].position - p0, vertices[indices[i + 2]].position - p0);
+					if (n.LengthSquared() > 0.0)
+						min_dp = std::min(min_dp, Dot(Normalize(n), meshlet.ConeAxis));
+				}
+				// a cone wider than ~84 degrees can always be seen from some side
+				meshlet.ConeCutoff = min_dp <= 0.1f ? 1.0f : std::sqrt(1.0f - min_dp * min_dp);
+
+				m_meshlets.push_back(meshlet);
+			}
+			lod.MeshletCount = (uint32_t)m_meshlets.size() - lod.MeshletStartLocation;
+		}
+	}
+}
+
+void Model::CompactIndices()
+{
+	// meshes with few enough vertices move to the 16 bit buffer, the rest is packed again
+	std::vector<uint32_t> index_buffer;
+	m_indexBuffer16.clear();
 	for (auto& mesh_pair : m_pMeshes)
 	{
 		Mesh* pMesh = mesh_pair.second;
-		pMesh->IndexStartLocation = cur_index_loc;
-		pMesh->VertexStartLocation = cur_vertex_loc;
-		
-		for (Face* pFace : pMesh->pFaces)
+		pMesh->IndexFormat = pMesh->VertexCount <= 0x10000 ? Index_Format_16 : Index_Format_32;
+		auto move_range = [&](uint32_t startLocation, uint32_t indexCount) -> uint32_t
 		{
-			auto vertex_start_loc = cur_vertex_loc;
-			for (int i = 0; i < 3; ++i)
+			auto first = m_indexBuffer.begin() + startLocation;
+			if (pMesh->IndexFormat == Index_Format_16)
 			{
-				Vertex& v = m_vertexBuffer[cur_vertex_loc];
-				v.position = positions[pFace->Positions[i]];
-				v.color = has_color_info ? positions[pFace->Positions[i]] : float4(1.0, 1.0, 1.0, 1.0);
-				v.normal = normals[pFace->Positions[i]];
-				v.uv = has_tex_coord_info ? texCoords[pFace->TexCoords[i]] : float2(0.0, 0.0);
-				v.tangent = tangents[pFace->Positions[i]];
-				v.bitangent = bitangents[pFace->Positions[i]];
-
-				m_indexBuffer[cur_index_loc] = cur_vertex_loc - pMesh->VertexStartLocation;
-
-				if (m_indexBuffer[cur_index_loc] + pMesh->VertexStartLocation > m_indexCount)
-					std::cout << m_indexBuffer[cur_index_loc] << " " << pMesh->VertexStartLocation << std::endl;
-				cur_vertex_loc++;
-				cur_index_loc++;
-
-				pMesh->BBox.Min(v.position);
-				pMesh->BBox.Max(v.position);
+				m_indexBuffer16.insert(m_indexBuffer16.end(), first, first + indexCount);
+				return (uint32_t)(m_indexBuffer16.size() - indexCount);
 			}
+			index_buffer.insert(index_buffer.end(), first, first + indexCount);
+			return (uint32_t)(index_buffer.size() - indexCount);
+		};
 
-			for (int i = 3; i < pFace->Positions.size(); ++i)
+		if (pMesh->LODs.empty())
+		{
+			pMesh->IndexStartLocation = move_range((uint32_t)pMesh->IndexStartLocation, pMesh->IndexCount);
+			continue;
+		}
+		for (MeshLOD& lod : pMesh->LODs)
+		{
+			uint32_t start_location = move_range(lod.IndexStartLocation, lod.IndexCount);
+			for (uint32_t i = 0; i < lod.MeshletCount; ++i)
 			{
-				Vertex& v = m_vertexBuffer[cur_vertex_loc];
-				v.position = positions[pFace->Positions[i]];
-				v.color = has_color_info ? positions[pFace->Positions[i]] : float4(1.0, 1.0, 1.0, 1.0);
-				v.normal = normals[pFace->Positions[i]];
-				v.uv = has_tex_coord_info ? texCoords[pFace->TexCoords[i]] : float2(0.0, 0.0);
-				v.tangent = tangents[pFace->Positions[i]];
-				v.bitangent = bitangents[pFace->Positions[i]];
-				cur_vertex_loc++;
-
-				m_indexBuffer[cur_index_loc] = vertex_start_loc - pMesh->VertexStartLocation;
-				cur_index_loc++;
-				m_indexBuffer[cur_index_loc] = vertex_start_loc + i - 1 - pMesh->VertexStartLocation;
-				cur_index_loc++;
-				m_indexBuffer[cur_index_loc] = vertex_start_loc + i - pMesh->VertexStartLocation;
-				if (m_indexBuffer[cur_index_loc] + pMesh->VertexStartLocation > m_indexCount)
-					std::cout << m_indexBuffer[cur_index_loc] << " " << pMesh->VertexStartLocation << std::endl;
-				cur_index_loc++;
-
-
-				pMesh->BBox.Min(v.position);
-				pMesh->BBox.Max(v.position);
+				Meshlet& meshlet = m_meshlets[lod.MeshletStartLocation + i];
+				meshlet.IndexStartLocation = meshlet.IndexStartLocation - lod.IndexStartLocation + start_location;
 			}
+			lod.IndexStartLocation = start_location;
+		}
+		pMesh->IndexStartLocation = pMesh->LODs[0].IndexStartLocation;
+	}
+	m_indexBuffer.swap(index_buffer);
+}
 
+void Model::BuildVertexStreams(bool packVertices, bool splitStreams)
+{
+	if (packVertices)
+	{
+		m_packedVertexBuffer.resize(m_vertexBuffer.size());
+		for (auto& mesh_pair : m_pMeshes)
+		{
+			Mesh* pMesh = mesh_pair.second;
+			float3 scale = GetQuantizationScale(pMesh->BBox);
+			for (uint32_t i = 0; i < pMesh->VertexCount; ++i)
+			{
+				size_t v = pMesh->VertexStartLocation + i;
+				m_packedVertexBuffer[v] = PackVertex(m_vertexBuffer[v], pMesh->BBox.BoxMin, scale);
+			}
 		}
-		m_bbox.Min(pMesh->BBox.BoxMin);
-		m_bbox.Max(pMesh->BBox.BoxMax);
+		if (splitStreams)
+		{
+			m_packedPositionStream.resize(m_packedVertexBuffer.size());
+			m_packedAttributeStream.resize(m_packedVertexBuffer.size());
+			for (size_t v = 0; v < m_packedVertexBuffer.size(); ++v)
+			{
+				m_packedPositionStream[v] = m_packedVertexBuffer[v].Position;
+				m_packedAttributeStream[v] = m_packedVertexBuffer[v].Attributes;
+			}
+			std::vector<PackedVertex>().swap(m_packedVertexBuffer);
+		}
+	}
+	else
+	{
+		m_positionStream.resize(m_vertexBuffer.size());
+		m_attributeStream.resize(m_vertexBuffer.size());
+		for (size_t v = 0; v < m_vertexBuffer.size(); ++v)
+		{
+			const Vertex& vertex = m_vertexBuffer[v];
+			m_positionStream[v] = vertex.position;
+			m_attributeStream[v] = { vertex.uv, vertex.normal, vertex.tangent, vertex.bitangent, vertex.color };
+		}
+	}
+	// the interleaved full vertices aren't needed anymore
+	std::vector<Vertex>().swap(m_vertexBuffer);
+}
+
+bool Model::LoadMeshCache(const std::string& filename, const std::string& sourceFilename, const ModelLoadDesc& desc)
+{
+	MappedFile file;
+	uint64_t source_size = 0;
+	int64_t source_time = 0;
+	if (!GetSourceKey(sourceFilename, source_size, source_time) || !file.Open(filename))
+		return false;
+
+	MeshCacheReader reader = { file.GetData(), file.GetData() + file.GetSize() };
+	MeshCacheHeader header = {};
+	reader.Read(header);
+	if (reader.Failed || header.Magic != MESH_CACHE_MAGIC || header.Version != MESH_CACHE_VERSION ||
+		header.VertexSize != sizeof(Vertex) || header.MeshletSize != sizeof(Meshlet) || header.SourceSize != source_size)
+		return false;
+	// a checkout or copy changes the time but not the contents
+	if (header.SourceTime != source_time && header.SourceHash != HashFile(sourceFilename))
+		return false;
+
+	std::vector<std::string> material_libs;
+	uint32_t num_material_libs = 0;
+	reader.Read(num_material_libs);
+	for (uint32_t i = 0; i < num_material_libs && !reader.Failed; ++i)
+	{
+		material_libs.emplace_back();
+		reader.Read(material_libs.back());
+	}
+	reader.Read(m_vertexBuffer);
+	reader.Read(m_indexBuffer);
+	reader.Read(m_indexBuffer16);
+	reader.Read(m_meshlets);
+	reader.Read(m_bbox);
+	uint64_t index_count = 0;
+	reader.Read(index_count);
+	m_indexCount = (size_t)index_count;
+
+	std::vector<std::pair<Mesh*, std::string>> mesh_materials;
+	uint32_t num_meshes = 0;
+	reader.Read(num_meshes);
+	for (uint32_t i = 0; i < num_meshes && !reader.Failed; ++i)
+	{
+		Mesh* mesh = new Mesh();
+		std::string mat_name;
+		uint64_t vertex_start_location = 0;
+		uint64_t index_start_location = 0;
+		reader.Read(mesh->Name);
+		reader.Read(mat_name);
+		reader.Read(vertex_start_location);
+		reader.Read(index_start_location);
+		reader.Read(mesh->IndexCount);
+		reader.Read(mesh->VertexCount);
+		reader.Read(mesh->IndexFormat);
+		reader.Read(mesh->BBox);
+		reader.Read(mesh->LODs);
+		mesh->VertexStartLocation = (size_t)vertex_start_location;
+		mesh->IndexStartLocation = (size_t)index_start_location;
+		m_pMeshes.insert({ mesh->Name, mesh });
+		mesh_materials.push_back({ mesh, mat_name });
+	}
+	if (reader.Failed)
+	{
+		std::cout << "mesh cache " << filename << " is truncated, rebuilding it" << std::endl;
+		for (auto& p : m_pMeshes)
+			delete p.second;
+		m_pMeshes.clear();
+		m_vertexBuffer.clear();
+		m_indexBuffer.clear();
+		m_indexBuffer16.clear();
+		m_meshlets.clear();
+		m_bbox = BoundingBox3D();
+		m_indexCount = 0;
+		return false;
+	}
+
+	// materials aren't cached, their textures go through the texture cache anyway
+	std::string path = sourceFilename.substr(0, sourceFilename.find_last_of('/') + 1);
+	Material* cur_mat = nullptr;
+	for (const std::string& material_lib : material_libs)
+		GetMaterialLib(material_lib, path, m_pMaterials, cur_mat, desc);
+	for (auto& mesh_material : mesh_materials)
+	{
+		if (!mesh_material.second.empty())
+			SetMaterial(mesh_material.second, m_pMaterials, mesh_material.first);
+	}
+
+	// the contents matched under a new time, it's stamped into the header so later loads skip the hash
+	if (header.SourceTime != source_time)
+	{
+		file.Close();
+		std::fstream fs(filename, std::ios::in | std::ios::out | std::ios::binary);
+		fs.seekp(offsetof(MeshCacheHeader, SourceTime));
+		fs.write((const char*)&source_time, sizeof(source_time));
+	}
+	return true;
+}
+
+void Model::SaveMeshCache(const std::string& filename, const std::string& sourceFilename, const std::vector<std::string>& materialLibs) const
+{
+	MeshCacheHeader header = {};
+	header.Magic = MESH_CACHE_MAGIC;
+	header.Version = MESH_CACHE_VERSION;
+	header.VertexSize = sizeof(Vertex);
+	header.MeshletSize = sizeof(Meshlet);
+	if (!GetSourceKey(sourceFilename, header.SourceSize, header.SourceTime))
+		return;
+	header.SourceHash = HashFile(sourceFilename);
+
+	// written aside and renamed, so a cache is never read half written
+	std::string temp_filename = filename + ".tmp";
+	std::ofstream fs(temp_filename, std::ios::binary | std::ios::trunc);
+	if (!fs.is_open())
+	{
+		std::cout << "fail to write mesh cache " << filename << std::endl;
+		return;
+	}
+	MeshCacheWriter writer = { fs };
+	writer.Write(header);
+	writer.Write((uint32_t)materialLibs.size());
+	for (const std::string& material_lib : materialLibs)
+		writer.Write(material_lib);
+	writer.Write(m_vertexBuffer);
+	writer.Write(m_indexBuffer);
+	writer.Write(m_indexBuffer16);
+	writer.Write(m_meshlets);
+	writer.Write(m_bbox);
+	writer.Write((uint64_t)m_indexCount);
+	writer.Write((uint32_t)m_pMeshes.size());
+	for (auto& mesh_pair : m_pMeshes)
+	{
+		const Mesh* pMesh = mesh_pair.second;
+		writer.Write(pMesh->Name);
+		writer.Write(pMesh->pMat != nullptr ? pMesh->pMat->Name : std::string());
+		writer.Write((uint64_t)pMesh->VertexStartLocation);
+		writer.Write((uint64_t)pMesh->IndexStartLocation);
+		writer.Write(pMesh->IndexCount);
+		writer.Write(pMesh->VertexCount);
+		writer.Write(pMesh->IndexFormat);
+		writer.Write(pMesh->BBox);
+		writer.Write(pMesh->LODs);
 	}
+	fs.close();
+
+	std::error_code error;
+	if (fs.fail())
+		std::cout << "fail to write mesh cache " << filename << std::endl;
+	else
+		std::filesystem::rename(temp_filename, filename, error);
+	if (fs.fail() || error)
+		std::filesystem::remove(temp_filename, error);
 }
 
-void Model::Draw(GraphicsContext& context, std::function<void(Material*)> setMatContext)
+void Model::BindVertexBuffer(GraphicsContext& context, const Mesh* pMesh)
 {
-	context.SetVertexBuffer(m_vertexBuffer.data());
-	context.SetIndexBuffer(m_indexBuffer.data());
+	if (!m_packedPositionStream.empty())
+		context.SetVertexStreams(m_packedPositionStream.data(), m_packedAttributeStream.data(), pMesh->BBox.BoxMin, GetQuantizationScale(pMesh->BBox));
+	else if (!m_packedVertexBuffer.empty())
+		context.SetVertexBuffer(m_packedVertexBuffer.data(), pMesh->BBox.BoxMin, GetQuantizationScale(pMesh->BBox));
+	else if (!m_positionStream.empty())
+		context.SetVertexStreams(m_positionStream.data(), m_attributeStream.data());
+	else
+		context.SetVertexBuffer(m_vertexBuffer.data());
+}
+
+int Model::SelectLOD(const ModelViewDesc& viewDesc, const Viewport& viewport) const
+{
+	float4 clip = Mul(float4(GetCenter(), 1.0f), viewDesc.ViewProj);
+	if (clip.w < 1e-5f)
+		return 0;
+
+	// the view rotation is orthonormal, so the y column of the view projection scales by the projection's y scale
+	const float4x4& m = viewDesc.ViewProj;
+	float scale_y = (float)float3(m.m[0][1], m.m[1][1], m.m[2][1]).Length();
+	float screen_size = GetRadius() * scale_y / clip.w * viewport.Height;
+
+	int lod = 0;
+	float threshold = LOD_FULL_DETAIL_SIZE;
+	while (screen_size < threshold && lod + 1 < MODEL_MAX_LODS)
+	{
+		threshold *= 0.5f;
+		++lod;
+	}
+	return lod;
+}
+
+void Model::Draw(GraphicsContext& context, std::function<void(Material*)> setMatContext, const ModelViewDesc* viewDesc)
+{
+	float4 frustum_planes[6];
+	float cone_sign = 0.0f;
+	int lod = 0;
+	if (viewDesc != nullptr)
+	{
+		GetFrustumPlanes(viewDesc->ViewProj, frustum_planes);
+		// the rasterizer culls on the sign of the ndc triple product, which equals the sign of
+		// dot(p0 - ViewOrigin, n) scaled by the sign of the view projection determinant
+		const RasterizerDesc& rs_desc = context.GetPipelineState()->RasterizerState;
+		if (rs_desc.CullMode != Cull_Mode_None)
+		{
+			cone_sign = Determinant(viewDesc->ViewProj) < 0.0f ? -1.0f : 1.0f;
+			if (rs_desc.FrontCounterClockWise)
+				cone_sign = -cone_sign;
+			if (rs_desc.CullMode == Cull_Mode_Front)
+				cone_sign = -cone_sign;
+		}
+		lod = SelectLOD(*viewDesc, *context.GetViewport());
+	}
+
 	for (auto& mesh_iter : m_pMeshes)
 	{
 		Mesh* pMesh = mesh_iter.second;
+		BindVertexBuffer(context, pMesh);
+		if (pMesh->IndexFormat == Index_Format_16)
+			context.SetIndexBuffer(m_indexBuffer16.data());
+		else
+			context.SetIndexBuffer(m_indexBuffer.data());
+
+		if (viewDesc == nullptr || pMesh->LODs.empty())
+		{
+			if (pMesh->pMat && setMatContext)
+			{
+				setMatContext(pMesh->pMat);
+			}
+			context.DrawIndexed(pMesh->IndexCount, pMesh->IndexStartLocation, pMesh->VertexStartLocation);
+			continue;
+		}
+
+		const MeshLOD& mesh_lod = pMesh->LODs[std::min<size_t>(lod, pMesh->LODs.size() - 1)];
+		m_visibleMeshlets.clear();
+		for (uint32_t i = 0; i < mesh_lod.MeshletCount; ++i)
+		{
+			const Meshlet& meshlet = m_meshlets[mesh_lod.MeshletStartLocation + i];
+			if (IsMeshletCulled(meshlet, *viewDesc, frustum_planes, cone_sign, context.GetViewport()))
+				continue;
+			m_visibleMeshlets.push_back({ meshlet.IndexCount, meshlet.IndexStartLocation, (uint32_t)pMesh->VertexStartLocation });
+		}
+		if (m_visibleMeshlets.empty())
+			continue;
+
 		if (pMesh->pMat && setMatContext)
 		{
 			setMatContext(pMesh->pMat);
 		}
-		context.DrawIndexed(pMesh->IndexCount, pMesh->IndexStartLocation, pMesh->VertexStartLocation);
+		context.MultiDrawIndexed(m_visibleMeshlets.data(), (uint32_t)m_visibleMeshlets.size());
 	}
 }
 
@@ -370,155 +1133,248 @@ float3 GetColorRGB(const std::string& dataBuffer, size_t& idx, size_t end)
 	return color;
 }
 
-void GetVertexInfo(const std::string& dataBuffer, size_t& idx, size_t end, std::vector<float3>& positions, std::vector<float3>& colors, std::vector<float2>& texCoords, std::vector<float3>& normals)
+void ParseOBJChunk(const char* begin, const char* end, const std::string& filename, OBJChunk& chunk)
+{
+	const char* line_beg = begin;
+	while (line_beg < end)
+	{
+		const char* next_line = (const char*)std::memchr(line_beg, '\n', end - line_beg);
+		next_line = next_line != nullptr ? next_line + 1 : end;
+		const char* line_end = line_beg;
+		while (line_end < next_line && !IsLineEnd(*line_end))
+			++line_end;
+
+		switch (*line_beg)
+		{
+		// get vertex position, (color), (texture coordinate), and normal
+		case 'v':
+			GetVertexInfo(line_beg + 1, line_end, chunk);
+			break;
+
+		// get face
+		case 'f':
+			GetFaceInfo(line_beg + 1, line_end, filename, chunk);
+			break;
+
+		// get group, the whole rest of the line names it
+		case 'g':
+		{
+			const char* name_beg = SkipSpaces(line_beg + 1, line_end);
+			chunk.Commands.push_back({ OBJ_Command_Group, std::string(name_beg, line_end - name_beg), chunk.Faces.FaceEnds.size() });
+		}
+		break;
+
+		// set group material
+		case 'u':
+		{
+			std::string mat_name = GetCommandName(line_beg, line_end, "usemtl");
+			// mat file name is empty
+			if (!mat_name.empty())
+				chunk.Commands.push_back({ OBJ_Command_Use_Material, mat_name, chunk.Faces.FaceEnds.size() });
+		}
+		break;
+
+		// get material info
+		case 'm':
+		{
+			if (line_end - line_beg >= 6 && std::memcmp(line_beg, "mtllib", 6) == 0)
+			{
+				std::string lib_name = GetCommandName(line_beg, line_end, "mtllib");
+				if (lib_name.empty())
+					std::cout << ".mtl file is empty" << std::endl;
+				else
+					chunk.Commands.push_back({ OBJ_Command_Material_Lib, lib_name, chunk.Faces.FaceEnds.size() });
+			}
+		}
+		break;
+		}
+
+		line_beg = next_line;
+	}
+}
+
+void GetVertexInfo(const char* iter, const char* end, OBJChunk& chunk)
 {
 	// vertex position
-	if (dataBuffer[idx] == ' ' || dataBuffer[idx] == '\t')
+	if (*iter == ' ' || *iter == '\t')
 	{
-		SkipToToken(dataBuffer, idx, end);
-		int num_components = CountNumricComponentsInLine(dataBuffer, idx, end);
+		float values[7];
+		int num_components = 0;
+		while (num_components < 7 && ParseFloat(iter, end, values[num_components]))
+			++num_components;
 		if (num_components == 3)
 		{
-			float x = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx);	SkipToken(dataBuffer, idx, end);
-			float y = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float z = std::atof(&dataBuffer[idx]);
-			positions.emplace_back(x, y, z);
+			chunk.Positions.emplace_back(values[0], values[1], values[2]);
 		}
 		else if (num_components == 4)
 		{
-			float x = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float y = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float z = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx);	SkipToken(dataBuffer, idx, end);
-			float w = std::atof(&dataBuffer[idx]);
-			positions.emplace_back(x / w, y / w, z / w);
+			chunk.Positions.emplace_back(values[0] / values[3], values[1] / values[3], values[2] / values[3]);
 		}
 		else if (num_components == 6)
 		{
-			float x = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx);	SkipToken(dataBuffer, idx, end);
-			float y = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float z = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float r = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float g = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			float b = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-			positions.emplace_back(x, y, z);
-			colors.emplace_back(r, g, b);
+			chunk.Positions.emplace_back(values[0], values[1], values[2]);
+			chunk.Colors.emplace_back(values[3], values[4], values[5]);
 		}
 	}
 	// vertex texture coordinate
-	else if (dataBuffer[idx] == 't')
+	else if (*iter == 't')
 	{
-		++idx;
-		SkipToToken(dataBuffer, idx, end);
-		float u = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx);	SkipToken(dataBuffer, idx, end);
-		float v = std::atof(&dataBuffer[idx]);
-		texCoords.emplace_back(u, v);
+		++iter;
+		float u = 0.0f;
+		float v = 0.0f;
+		if (ParseFloat(iter, end, u))
+			ParseFloat(iter, end, v);
+		chunk.TexCoords.emplace_back(u, v);
 	}
 	// vertex normal
-	else if (dataBuffer[idx] == 'n')
+	else if (*iter == 'n')
 	{
-		++idx;
-		SkipToToken(dataBuffer, idx, end);
-		float x = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx);	SkipToken(dataBuffer, idx, end);
-		float y = std::atof(&dataBuffer[idx]); SkipSpaces(dataBuffer, idx); SkipToken(dataBuffer, idx, end);
-		float z = std::atof(&dataBuffer[idx]);
-		normals.emplace_back(x, y, z);
+		++iter;
+		float x = 0.0f;
+		float y = 0.0f;
+		float z = 0.0f;
+		if (ParseFloat(iter, end, x) && ParseFloat(iter, end, y))
+			ParseFloat(iter, end, z);
+		chunk.Normals.emplace_back(x, y, z);
 	}
 }
 
-void GetFaceInfo(const std::string& dataBuffer, size_t& idx, size_t end, const std::string& filename, const std::string& meshName, Mesh*& pCurMesh, std::unordered_map<std::string, Mesh*>& meshMap, size_t& modelIndexCount, size_t numPositions, size_t numTexCoords, size_t numNormals)
+void GetFaceInfo(const char* iter, const char* end, const std::string& filename, OBJChunk& chunk)
 {
-	int pos = 0;
-	Face* face = new Face();
-	while (idx < end)
+	// position/tex coord/normal
+	int stream = 0;
+	bool relative = false;
+	std::vector<FaceCorner>& corners = chunk.Faces.Corners;
+	size_t corner_begin = corners.size();
+	while (iter < end)
 	{
-		int step = 1;
-		if (dataBuffer[idx] == '/')
+		if (*iter == '/')
 		{
-			pos++;
+			++stream;
+			++iter;
+			continue;
 		}
-		else if (dataBuffer[idx] == ' ')
+		if (*iter == ' ' || *iter == '\t')
 		{
-			pos = 0;
+			stream = 0;
+			++iter;
+			continue;
 		}
-		else
-		{
-			int index = std::atoi(&dataBuffer[idx]);
-			if (index < 0)
-			{
-				++step;
-			}
-			int tmp = index;
-			while ((tmp = tmp / 10) != 0)
-			{
-				++step;
-			}
 
-			if (index > 0)
-			{
-				if (pos == 0)
-					face->Positions.push_back(index - 1);
-				else if (pos == 1)
-					face->TexCoords.push_back(index - 1);
-				else if (pos == 2)
-					face->Normals.push_back(index - 1);
-				else
-					std::cout << "Error face in " << filename << std::endl;
-			}
-			else if (index < 0)
-			{
-				if (pos == 0)
-					face->Positions.push_back(numPositions + index);
-				else if (pos == 1)
-					face->TexCoords.push_back(numTexCoords + index);
-				else if (pos == 2)
-					face->Normals.push_back(numNormals + index);
-				else
-					std::cout << "Error face in " << filename << std::endl;
-			}
-			else
-			{
-				delete face;
-				std::cout << "Invalid face indices in " << filename << std::endl;
-			}
+		int index = 0;
+		if (!ParseInt(iter, end, index) || index == 0)
+		{
+			corners.resize(corner_begin);
+			std::cout << "Invalid face indices in " << filename << std::endl;
+			return;
 		}
-		idx += step;
+		if (stream > 2)
+		{
+			std::cout << "Error face in " << filename << std::endl;
+			continue;
+		}
+		uint32_t value = index > 0 ? index - 1 : (uint32_t)index;
+		if (stream == 0)
+			corners.push_back({ value, OBJ_MISSING_INDEX, OBJ_MISSING_INDEX });
+		else if (corners.size() > corner_begin)
+			(stream == 1 ? corners.back().TexCoord : corners.back().Normal) = value;
+		relative |= index < 0;
 	}
-	if (face->Positions.empty())
+	if (corners.size() - corner_begin < 3)
 	{
-		std::cout << "Empty face in " << filename << std::endl;
-		delete face;
+		std::cout << "Face with less than 3 vertices in " << filename << std::endl;
+		corners.resize(corner_begin);
 	}
 	else
 	{
-		if (pCurMesh == nullptr)
-		{
-			pCurMesh = new Mesh(meshName);
-			meshMap.insert({ meshName, pCurMesh });
-		}
-		pCurMesh->pFaces.push_back(face);
-		pCurMesh->IndexCount += (face->Positions.size() - 2) * 3;
-		modelIndexCount += (face->Positions.size() - 2) * 3;
+		if (relative)
+			chunk.RelativeFaces.push_back({ (uint32_t)chunk.Faces.FaceEnds.size(), { (uint32_t)chunk.Positions.size(), (uint32_t)chunk.TexCoords.size(), (uint32_t)chunk.Normals.size() } });
+		chunk.Faces.FaceEnds.push_back((uint32_t)corners.size());
 	}
 }
 
-void SetMaterial(const std::string& dataBuffer, size_t& idx, size_t end, std::unordered_map<std::string, Material*>& matMap, Mesh* pCurMesh)
+std::string GetCommandName(const char* iter, const char* end, const char* command)
+{
+	// the name is the token after the command, if the line starts with it
+	const char* cmd_end = iter;
+	while (cmd_end < end && *cmd_end != ' ')
+		++cmd_end;
+	if ((size_t)(cmd_end - iter) != std::strlen(command) || std::memcmp(iter, command, cmd_end - iter) != 0)
+		return std::string();
+	const char* name_beg = SkipSpaces(cmd_end, end);
+	const char* name_end = name_beg;
+	while (name_end < end && *name_end != ' ')
+		++name_end;
+	return std::string(name_beg, name_end - name_beg);
+}
+
+void AddTangentFrame(const FaceCorner* corners, uint32_t cornerCount, OBJStreams& streams)
 {
-	auto mat_end = idx;
-	while (mat_end < end && dataBuffer[mat_end] != ' ')
+	auto get_uv = [&](const FaceCorner& corner)
+	{
+		return corner.TexCoord < streams.TexCoords.size() ? streams.TexCoords[corner.TexCoord] : float2(0.0, 0.0);
+	};
+	auto get_normal = [&](const FaceCorner& corner)
 	{
-		mat_end++;
+		return corner.Normal < streams.Normals.size() ? streams.Normals[corner.Normal] : float3(0.0, 0.0, 0.0);
+	};
+
+	for (uint32_t i = 0; i < cornerCount - 2; ++i)
+	{
+		auto i0 = corners[0].Position;
+		auto i1 = corners[i + 1].Position;
+		auto i2 = corners[i + 2].Position;
+		const auto& p0 = streams.Positions[i0];
+		const auto& p1 = streams.Positions[i1];
+		const auto& p2 = streams.Positions[i2];
+		float2 uv0 = get_uv(corners[0]);
+		float2 uv1 = get_uv(corners[i + 1]);
+		float2 uv2 = get_uv(corners[i + 2]);
+
+		float3 e1 = p1 - p0, e2 = p2 - p0;
+		float x1 = uv1.x - uv0.x, x2 = uv2.x - uv0.x;
+		float y1 = uv2.y - uv0.y, y2 = uv2.y - uv0.y;
+
+		float r = 1.0f / std::max((x1 * y2 - x2 * y1), 0.00001f);
+		float3 t = (e1 * y2 - e2 * y1) * r;
+		float3 b = (e2 * x1 - e1 * x2) * r;
+
+		streams.Tangents[i0] += t;
+		streams.Tangents[i1] += t;
+		streams.Tangents[i2] += t;
+
+		streams.Bitangents[i0] += b;
+		streams.Bitangents[i1] += b;
+		streams.Bitangents[i2] += b;
+
+		streams.SmoothedNormals[i0] += get_normal(corners[0]);
+		streams.SmoothedNormals[i1] += get_normal(corners[i + 1]);
+		streams.SmoothedNormals[i2] += get_normal(corners[i + 2]);
 	}
+}
 
-	// mat file name is empty
-	if (mat_end == idx)
-		return;
+void NormalizeTangentFrames(OBJStreams& streams)
+{
+	for (size_t i = 0; i < streams.Positions.size(); ++i)
+	{
+		streams.SmoothedNormals[i] = Normalize(streams.SmoothedNormals[i]);
+		const auto& n = streams.SmoothedNormals[i];
+		if (streams.TexCoords.empty())
+			continue;
+		const auto& t = streams.Tangents[i];
+		const auto& b = streams.Bitangents[i];
+		streams.Tangents[i] = Normalize(t - Dot(t, n) * n);
+		streams.Bitangents[i] = Normalize(b - Dot(b, n) * n - Dot(b, streams.Tangents[i]) * streams.Tangents[i]);
+	}
+}
 
+void SetMaterial(const std::string& matName, std::unordered_map<std::string, Material*>& matMap, Mesh* pCurMesh)
+{
 	// already add material
-	std::string mat_name(&dataBuffer[idx], mat_end - idx);
-	if (pCurMesh->pMat != nullptr && pCurMesh->pMat->Name == mat_name)
+	if (pCurMesh->pMat != nullptr && pCurMesh->pMat->Name == matName)
 		return;
 
-	auto mat_iter = matMap.find(mat_name);
+	auto mat_iter = matMap.find(matName);
 	if (mat_iter == matMap.end())
 	{
 		std::cout << "fail to locate material" << std::endl;
@@ -529,21 +1385,8 @@ void SetMaterial(const std::string& dataBuffer, size_t& idx, size_t end, std::un
 	}
 }
 
-void GetMaterialLib(const std::string& dataBuffer, size_t& idx, size_t end, const std::string& path, std::unordered_map<std::string, Material*>& matMap, Material*& pCurMat)
+void GetMaterialLib(const std::string& filename, const std::string& path, std::unordered_map<std::string, Material*>& matMap, Material*& pCurMat, const ModelLoadDesc& desc)
 {
-	auto mat_end = idx;
-	while (mat_end < end && dataBuffer[mat_end] != ' ')
-	{
-		mat_end++;
-	}
-
-	if (mat_end == idx)
-	{
-		std::cout << ".mtl file is empty" << std::endl;
-		return;
-	}
-
-	std::string filename(&dataBuffer[idx], mat_end - idx);
 	std::ifstream fs;
 	fs.open(path + filename);
 	if (!fs.is_open())
@@ -553,6 +1396,13 @@ void GetMaterialLib(const std::string& dataBuffer, size_t& idx, size_t end, cons
 	}
 
 	std::string mat_data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+	// the last map of each slot wins, textures are loaded once the whole library is parsed
+	struct TextureRequest
+	{
+		std::string Name;
+		bool NormalMap;
+	};
+	std::unordered_map<std::shared_ptr<Texture>*, TextureRequest> texture_requests;
 	size_t line_beg = 0;
 	size_t line_end = FindLineEnd(mat_data, line_beg);
 	while (line_beg < mat_data.size())
@@ -672,33 +1522,21 @@ void GetMaterialLib(const std::string& dataBuffer, size_t& idx, size_t end, cons
 			// diffuse texture
 			if (cmd == "map_Kd")
 			{
-				if (pCurMat->pDiffuseMap != nullptr)
-					delete pCurMat->pDiffuseMap;
-				pCurMat->pDiffuseMap = new Texture(file_path);
-				pCurMat->pDiffuseMap->LoadFromTGA(path + file_path);
+				texture_requests[&pCurMat->pDiffuseMap] = { file_path, false };
 			}
 			// ambient texture
 			else if (cmd == "map_Ka")
 			{
-				if (pCurMat->pAmbientMap != nullptr)
-					delete pCurMat->pAmbientMap;
-				pCurMat->pAmbientMap = new Texture(file_path);
-				pCurMat->pAmbientMap->LoadFromTGA(path + file_path);
+				texture_requests[&pCurMat->pAmbientMap] = { file_path, false };
 			}
 			// specular texture
 			else if (cmd == "map_Ks")
 			{
-				if (pCurMat->pSpecularMap != nullptr)
-					delete pCurMat->pSpecularMap;
-				pCurMat->pSpecularMap = new Texture(file_path);
-				pCurMat->pSpecularMap->LoadFromTGA(path + file_path);
+				texture_requests[&pCurMat->pSpecularMap] = { file_path, false };
 			}
 			else if (cmd == "map_bump")
 			{
-				if (pCurMat->pBumpMap1 != nullptr)
-					delete pCurMat->pBumpMap1;
-				pCurMat->pBumpMap1 = new Texture(file_path);
-				pCurMat->pBumpMap1->LoadFromTGA(path + file_path);
+				texture_requests[&pCurMat->pBumpMap1] = { file_path, true };
 			}
 		}
 		break;
@@ -707,4 +1545,116 @@ void GetMaterialLib(const std::string& dataBuffer, size_t& idx, size_t end, cons
 		line_beg = 1 + (IsLineEnd(mat_data[line_beg]) ? line_beg : line_end);
 		line_end = FindLineEnd(mat_data, line_beg);
 	}
+
+	for (auto& request : texture_requests)
+	{
+		TextureLoadDesc texture_desc;
+		texture_desc.Compress = desc.CompressTextures;
+		texture_desc.NormalMap = request.second.NormalMap;
+		texture_desc.pPageCache = desc.pPageCache;
+		*request.first = TextureCache::Get().Load(path + request.second.Name, texture_desc, desc.pLoader);
+	}
+}
+
+void GetFrustumPlanes(const float4x4& viewProj, float4 planes[6])
+{
+	// row vector convention, clip = float4(p, 1) * viewProj
+	float4 col[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		col[i] = float4(viewProj.m[0][i], viewProj.m[1][i], viewProj.m[2][i], viewProj.m[3][i]);
+	}
+	planes[0] = col[3] + col[0];
+	planes[1] = col[3] - col[0];
+	planes[2] = col[3] + col[1];
+	planes[3] = col[3] - col[1];
+	planes[4] = col[2];
+	planes[5] = col[3] - col[2];
+	for (int i = 0; i < 6; ++i)
+	{
+		planes[i] = planes[i] / (float)float3(planes[i]).Length();
+	}
+}
+
+bool IsMeshletCulled(const Meshlet& meshlet, const ModelViewDesc& viewDesc, const float4 planes[6], float coneSign, const Viewport* viewport)
+{
+	// frustum
+	for (int i = 0; i < 6; ++i)
+	{
+		if (Dot(float3(planes[i]), meshlet.Center) + planes[i].w < -meshlet.Radius)
+			return true;
+	}
+
+	// back face cone
+	if (coneSign != 0.0f)
+	{
+		float3 to_center = meshlet.Center - viewDesc.ViewOrigin;
+		if (Dot(to_center, meshlet.ConeAxis) * coneSign >= meshlet.ConeCutoff * (float)to_center.Length() + meshlet.Radius)
+			return true;
+	}
+
+	// occlusion
+	if (viewDesc.pHiZ != nullptr && !viewDesc.pHiZ->IsEmpty())
+	{
+		float2 uv_min(FLT_MAX);
+		float2 uv_max(-FLT_MAX);
+		float nearest_depth = FLT_MAX;
+		for (int i = 0; i < 8; ++i)
+		{
+			float3 corner = meshlet.Center + float3(
+				i & 1 ? meshlet.Radius : -meshlet.Radius,
+				i & 2 ? meshlet.Radius : -meshlet.Radius,
+				i & 4 ? meshlet.Radius : -meshlet.Radius);
+			float4 clip = Mul(float4(corner, 1.0f), viewDesc.ViewProj);
+			// crossing the near plane, can't bound it on screen
+			if (clip.w < 1e-5f)
+				return false;
+			float3 ndc = float3(clip / clip.w);
+			float2 uv = float2(ndc.x * 0.5f + 0.5f, 0.5f - ndc.y * 0.5f);
+			uv_min = Min(uv_min, uv);
+			uv_max = Max(uv_max, uv);
+			nearest_depth = std::min(nearest_depth, viewport->MinDepth + ndc.z * (viewport->MaxDepth - viewport->MinDepth));
+		}
+		if (viewDesc.pHiZ->IsOccluded(uv_min, uv_max, nearest_depth))
+			return true;
+	}
+
+	return false;
+}
+
+float3 GetQuantizationScale(const BoundingBox3D& bbox)
+{
+	return (bbox.BoxMax - bbox.BoxMin) / 65535.0f;
+}
+
+bool GetSourceKey(const std::string& filename, uint64_t& size, int64_t& time)
+{
+	std::error_code error;
+	std::filesystem::path path(filename);
+	size = (uint64_t)std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+	time = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+uint64_t HashFile(const std::string& filename)
+{
+	// fnv-1a over 8 byte words, the tail byte by byte
+	MappedFile file;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	if (!file.Open(filename))
+		return hash;
+	const char* data = file.GetData();
+	size_t size = file.GetSize();
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+	for (; i < size; ++i)
+		hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ull;
+	return hash;
 }
\ No newline at end of file
@@ -2,23 +2,42 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <memory>
 #include "math/math.h"
 #include "graphics.h"
 
+#define MESHLET_MAX_TRIANGLES 128
+#define MODEL_MAX_LODS 4
+// projected model diameter in pixels above which the full resolution mesh is drawn, every halving selects the next lod
+#define LOD_FULL_DETAIL_SIZE 256.0f
+
 class Texture;
+class HiZBuffer;
+class VirtualTextureCache;
+class AssetLoader;
+struct OBJStreams;
+struct MeshBuilder;
 
-struct Face
+// obj indices of one polygon corner, a missing tex coord or normal is past the end of its stream
+struct FaceCorner
 {
-	std::vector<uint32_t> Positions;
-	std::vector<uint32_t> TexCoords;
-	std::vector<uint32_t> Normals;
+	uint32_t Position;
+	uint32_t TexCoord;
+	uint32_t Normal;
+};
+
+// polygons stored back to back, only kept until the model is built
+struct FaceList
+{
+	std::vector<FaceCorner> Corners;
+	// face i ends at FaceEnds[i] and starts where face i - 1 ends
+	std::vector<uint32_t> FaceEnds;
 };
 
 struct Material
 {
 	Material(const std::string& name) : Name(name) {}
 	Material() : Name("Default"){}
-	~Material();
 	std::string Name;
 	float3 Ambient;
 	float3 Diffuse;
@@ -27,62 +46,131 @@ struct Material
 	float Shineness;
 	float IndexOfRefraction;
 	float4 Transparent;
-	Texture* pDiffuseMap = nullptr;
-	Texture* pAmbientMap = nullptr;
-	Texture* pSpecularMap = nullptr;
-	Texture* pOpacityMap = nullptr;
-	Texture* pEmissiveMap1 = nullptr;
-	Texture* pEmissiveMap2 = nullptr;
-	Texture* pBumpMap1 = nullptr;
-	Texture* pBumpMap2 = nullptr;
-	Texture* pNormalMap = nullptr;
-	Texture* pReflectionMap = nullptr;
-	Texture* pDisplaceTexture1 = nullptr;
-	Texture* pDisplaceTexture2 = nullptr;
+	// shared through the texture cache
+	std::shared_ptr<Texture> pDiffuseMap;
+	std::shared_ptr<Texture> pAmbientMap;
+	std::shared_ptr<Texture> pSpecularMap;
+	std::shared_ptr<Texture> pOpacityMap;
+	std::shared_ptr<Texture> pEmissiveMap1;
+	std::shared_ptr<Texture> pEmissiveMap2;
+	std::shared_ptr<Texture> pBumpMap1;
+	std::shared_ptr<Texture> pBumpMap2;
+	std::shared_ptr<Texture> pNormalMap;
+	std::shared_ptr<Texture> pReflectionMap;
+	std::shared_ptr<Texture> pDisplaceTexture1;
+	std::shared_ptr<Texture> pDisplaceTexture2;
+};
+
+// a small cluster of triangles culled as a whole before any vertex is shaded
+struct Meshlet
+{
+	float3 Center;
+	float Radius;
+	// normal cone of the (unnormalized) triangle normals, cutoff >= 1 means never cone culled
+	float3 ConeAxis;
+	float ConeCutoff;
+	uint32_t IndexStartLocation;
+	uint32_t IndexCount;
+};
+
+// view a model is drawn from, drives meshlet culling and lod selection
+struct ModelViewDesc
+{
+	float4x4 ViewProj;
+	// world position that maps to the ndc origin, face culling is relative to it
+	float3 ViewOrigin;
+	// optional, built from a previous depth buffer of the same view
+	const HiZBuffer* pHiZ = nullptr;
+};
+
+// how LoadFromOBJ lays out a model and its material textures
+struct ModelLoadDesc
+{
+	// quantizes vertices to each mesh's bounds
+	bool PackVertices = false;
+	// stores positions apart from the other attributes
+	bool SplitStreams = false;
+	// block compressed textures, bc5 for bump maps that are tangent space normal maps
+	bool CompressTextures = false;
+	// virtual textures, only the sampled pages stay in memory
+	VirtualTextureCache* pPageCache = nullptr;
+	// textures decode on the loader's threads while the model is parsed and fill in as they finish,
+	// wait on the loader before drawing
+	AssetLoader* pLoader = nullptr;
+	// keeps the built model in a binary <obj>.meshcache file next to the obj, later loads map it instead of
+	// parsing. off by default since it writes into the asset folder. it's rebuilt when the obj changes,
+	// materials are always read from their .mtl files
+	bool MeshCache = false;
+	// nonzero reads the obj through a window of this many bytes instead of mapping all of it. the file is read
+	// three times, for the vertex streams, the tangents and the triangles, so the faces are never all in memory
+	// the window grows to fit a long line, up to 16 times this size. a longer line is reported and skipped
+	size_t StreamWindowSize = 0;
+};
+
+// one resolution of a mesh, all lods index the mesh's vertex range
+struct MeshLOD
+{
+	uint32_t IndexStartLocation;
+	uint32_t IndexCount;
+	uint32_t MeshletStartLocation;
+	uint32_t MeshletCount;
 };
 
 struct Mesh
 {
-	Mesh() : pMat(nullptr), IndexCount(0), Name("Default") {	}
-	Mesh(const std::string& name) : pMat(nullptr), IndexCount(0), Name(name) {	}
-	~Mesh();
+	Mesh() : pMat(nullptr), IndexCount(0), VertexCount(0), IndexFormat(Index_Format_32), Name("Default") {	}
+	Mesh(const std::string& name) : pMat(nullptr), IndexCount(0), VertexCount(0), IndexFormat(Index_Format_32), Name(name) {	}
 	std::string Name;
+	// belongs to the model
 	Material* pMat;
-	std::vector<Face*> pFaces;
+	FaceList Faces;
 	size_t VertexStartLocation;
 	size_t IndexStartLocation;
 	uint32_t IndexCount;
+	uint32_t VertexCount;
+	// 16 bit meshes index m_indexBuffer16, all their lods and meshlets too
+	eIndexFormat IndexFormat;
+	std::vector<MeshLOD> LODs;
 	BoundingBox3D BBox;
 };
 
 class Model
 {
 public:
-	Model() {}
+	Model() : m_indexCount(0) {}
 	~Model();
-	void LoadFromOBJ(const std::string& filename);
-	void Draw(GraphicsContext& context, std::function<void(Material*)> setMatContext = nullptr);
+	void LoadFromOBJ(const std::string& filename, const ModelLoadDesc& desc = ModelLoadDesc());
+	void Draw(GraphicsContext& context, std::function<void(Material*)> setMatContext = nullptr, const ModelViewDesc* viewDesc = nullptr);
 	float3 GetCenter() const { return (m_bbox.BoxMin + m_bbox.BoxMax) * 0.5f; }
 	float GetRadius() const { return (m_bbox.BoxMax - m_bbox.BoxMin).Length() * 0.5f; }
 	void CreateAsQuad();
 private:
-	void SmoothNormalAndBuildTangents(
-		std::vector<float3>& positions, 
-		std::vector<float2>& texCoords, 
-		std::vector<float3>& normals, 
-		std::vector<float3>& smoothedNormals, 
-		std::vector<float3>& tangents, 
-		std::vector<float3>& bitangents);
-	void BuildModel(std::vector<float3>& positions,
-		std::vector<float3>& colors,
-		std::vector<float2>& texCoords,
-		std::vector<float3>& normals,
-		std::vector<float3>& tangents,
-		std::vector<float3>& bitangents);
+	void SmoothNormalAndBuildTangents(OBJStreams& streams);
+	void BuildModel(const OBJStreams& streams);
+	// the face's triangles go to the mesh's range of the index buffer, meshes can be built in any order
+	void AddFace(const FaceCorner* corners, uint32_t cornerCount, const OBJStreams& streams, MeshBuilder& builder);
+	void FinishMesh(MeshBuilder& builder);
+	void BuildLODs();
+	void BuildMeshlets();
+	void CompactIndices();
+	void BuildVertexStreams(bool packVertices, bool splitStreams);
+	// the meshes, buffers and meshlets as they are before BuildVertexStreams
+	bool LoadMeshCache(const std::string& filename, const std::string& sourceFilename, const ModelLoadDesc& desc);
+	void SaveMeshCache(const std::string& filename, const std::string& sourceFilename, const std::vector<std::string>& materialLibs) const;
+	void BindVertexBuffer(GraphicsContext& context, const Mesh* pMesh);
+	int SelectLOD(const ModelViewDesc& viewDesc, const Viewport& viewport) const;
 	std::unordered_map<std::string, Mesh*> m_pMeshes;
 	std::unordered_map<std::string, Material*> m_pMaterials;
 	std::vector<Vertex> m_vertexBuffer;
+	std::vector<PackedVertex> m_packedVertexBuffer;
+	std::vector<float3> m_positionStream;
+	std::vector<VertexAttributes> m_attributeStream;
+	std::vector<PackedPosition> m_packedPositionStream;
+	std::vector<PackedAttributes> m_packedAttributeStream;
 	std::vector<uint32_t> m_indexBuffer;
+	std::vector<uint16_t> m_indexBuffer16;
+	std::vector<Meshlet> m_meshlets;
+	std::vector<DrawIndexedArgs> m_visibleMeshlets;
 	BoundingBox3D m_bbox;
 	size_t m_indexCount;
 };
\ No newline at end of file
@@ -6,8 +6,32 @@
 #include <iostream>
 #include <algorithm>
 #include <type_traits>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <emmintrin.h>
+#include "pixel_convert.h"
 
-template <typename T, int NumChannels, bool AllocateMem>
+#define PIXEL_TILE_SIZE 8
+
+enum eTileState
+{
+	Tile_State_Valid,
+	Tile_State_Cleared,
+	Tile_State_Materializing
+};
+
+// morton order of a pixel inside its tile, x in the even bits
+inline int TileMortonIndex(int x, int y)
+{
+	return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+}
+
+// tiled buffers store 8x8 tiles row by row with the pixels of a tile in morton order,
+// so a triangle touching a small block of pixels stays within a few cache lines.
+// clearing a tiled buffer only flags its tiles, reads of a cleared tile return the clear value
+// and the first write fills the tile
+template <typename T, int NumChannels, bool AllocateMem, bool Tiled = false>
 class PixelBuffer
 {
 public:
@@ -15,7 +39,7 @@ public:
 		: m_width(width), m_height(height)
 	{
 		assert(m_width > 0 && m_height > 0);
-		m_bufferSize = m_width * m_height * NumChannels;
+		UpdateBufferSize();
 
 		if (AllocateMem)
 		{
@@ -32,31 +56,56 @@ public:
 		}
 	}
 
+	// wraps memory owned elsewhere, e.g. by a RenderTargetPool, it must hold ComputeBufferSize values
+	PixelBuffer(int width, int height, T* buffer)
+		: m_width(width), m_height(height), m_buffer(buffer), m_ownsBuffer(false)
+	{
+		assert(m_width > 0 && m_height > 0);
+		UpdateBufferSize();
+	}
+
 	~PixelBuffer()
 	{
-		if (AllocateMem)
+		if (AllocateMem && m_ownsBuffer)
 			delete[] m_buffer;
 	}
 
 	PixelBuffer(const PixelBuffer&) = delete;
 	PixelBuffer& operator=(const PixelBuffer& rhs) = delete;
 
-	unsigned char* GetBuffer() { return m_buffer; }
+	// values stored for the given size, tiled buffers are padded to whole tiles
+	static size_t ComputeBufferSize(int width, int height)
+	{
+		if (Tiled)
+			return (size_t)((width + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE) * ((height + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE) * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * NumChannels;
+		return (size_t)width * height * NumChannels;
+	}
+
+	T* GetBuffer() { return m_buffer; }
 	const int GetWidth() const { return m_width; }
 	const int GetHeight() const { return m_height; }
 	const size_t GetBufferSize() const { return m_bufferSize; }
 	void SetWidth(int width) 
 	{ 
 		m_width = width; 
-		m_bufferSize = m_width * m_height * NumChannels; 
+		UpdateBufferSize();
 	}
 	
 	void SetHeight(int height) 
 	{
 		m_height = height; 
-		m_bufferSize = m_width * m_height * NumChannels;
+		UpdateBufferSize();
 	}
 
+	// index of the first channel of a pixel
+	size_t GetIndex(int x, int y) const
+	{
+		if (Tiled)
+			return (GetTile(x, y) * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE + TileMortonIndex(x, y)) * NumChannels;
+		return ((size_t)m_width * y + x) * NumChannels;
+	}
+
+	// raw access, ignores pending clears
 	T GetValue(size_t idx) const
 	{
 		assert(idx < m_bufferSize);
@@ -65,28 +114,52 @@ public:
 
 	T GetValue(int x, int y) const
 	{
-		int index = m_width * y * NumChannels + x * NumChannels;
-		return m_buffer[index];
+		if (Tiled && IsTileCleared(GetTile(x, y)))
+			return m_clearValue[0];
+		return m_buffer[GetIndex(x, y)];
 	}
 
+	// raw access, ignores pending clears
 	void SetValue(size_t idx, T value)
 	{
 		assert(idx < m_bufferSize);
 		m_buffer[idx] = value;
 	}
 
+	// all channels of a pixel, the clear value for cleared tiles
+	void GetPixel(int x, int y, T* value) const
+	{
+		assert(x < m_width && y < m_height);
+		if (Tiled && IsTileCleared(GetTile(x, y)))
+			std::memcpy(value, m_clearValue, sizeof(m_clearValue));
+		else
+			std::memcpy(value, m_buffer + GetIndex(x, y), sizeof(T) * NumChannels);
+	}
+
 	void SetValue(int x, int y, T value)
 	{
-		int idx = m_width * y * NumChannels + x * NumChannels;
+		if (Tiled)
+			MaterializeTile(GetTile(x, y));
+		size_t idx = GetIndex(x, y);
 		assert(idx < m_bufferSize);
 		m_buffer[idx] = value;
 	}
+	// all channels of a pixel at once
+	void SetPixel(int x, int y, const T* value)
+	{
+		assert(x < m_width && y < m_height);
+		if (Tiled)
+			MaterializeTile(GetTile(x, y));
+		std::memcpy(m_buffer + GetIndex(x, y), value, sizeof(T) * NumChannels);
+	}
 	void SetColorRGB(int x, int y, Color color)
 	{
 		assert(x < m_width && y < m_height);
+		if (Tiled)
+			MaterializeTile(GetTile(x, y));
 		//int flipped_row = m_height - y - 1;
 		//int index = flipped_row * m_width * m_channels + x * m_channels;
-		int index = m_width * y * NumChannels + x * NumChannels;
+		size_t index = GetIndex(x, y);
 		m_buffer[index] = std::clamp(color.x, 0.0f, 1.0f) * 255;
 		m_buffer[index + 1] = std::clamp(color.y, 0.0f, 1.0f) * 255;
 		m_buffer[index + 2] = std::clamp(color.z, 0.0f, 1.0f) * 255;
@@ -96,9 +169,11 @@ public:
 	void SetColorBGR(int x, int y, Color color)
 	{
 		assert(x < m_width && y < m_height);
+		if (Tiled)
+			MaterializeTile(GetTile(x, y));
 		//int flipped_row = m_height - y - 1;
 		//int index = flipped_row * m_width * m_channels + x * m_channels;
-		int index = m_width * y * NumChannels + x * NumChannels;
+		size_t index = GetIndex(x, y);
 		m_buffer[index] = std::clamp(color.z, 0.0f, 1.0f) * 255;
 		m_buffer[index + 1] = std::clamp(color.y, 0.0f, 1.0f) * 255;
 		m_buffer[index + 2] = std::clamp(color.x, 0.0f, 1.0f) * 255;
@@ -110,36 +185,236 @@ public:
 		m_buffer = buffer;
 	}
 
-	void Clear(Color color)
+	// value holds one pixel, O(tiles) for tiled buffers
+	void Clear(const T* value)
 	{
+		std::memcpy(m_clearValue, value, sizeof(m_clearValue));
+		if (Tiled)
 		{
-#pragma omp parallel for schedule(dynamic)
+			size_t num_tiles = (size_t)m_tilesX * m_tilesY;
+			for (size_t i = 0; i < num_tiles; ++i)
+				m_tileStates[i].store(Tile_State_Cleared, std::memory_order_relaxed);
+			return;
+		}
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < m_height; ++y)
+		{
+			T* row = m_buffer + (size_t)m_width * y * NumChannels;
 			for (int x = 0; x < m_width; ++x)
+				std::memcpy(row + x * NumChannels, value, sizeof(m_clearValue));
+		}
+	}
+
+	// detile into a linear buffer of the same size, e.g. the frame buffer on present
+	template <bool DstAllocateMem>
+	void CopyTo(PixelBuffer<T, NumChannels, DstAllocateMem, false>& dst) const
+	{
+		if (!Tiled)
+		{
+			assert(dst.GetWidth() == m_width && dst.GetHeight() == m_height);
+			std::memcpy(dst.GetBuffer(), m_buffer, (size_t)m_width * m_height * NumChannels * sizeof(T));
+			return;
+		}
+		ConvertTo(dst, [](const T* src, T* dst, size_t count) { std::memcpy(dst, src, count * NumChannels * sizeof(T)); });
+	}
+
+	// writes into a linear buffer of the same size through convert(src, dst, pixelCount), which is
+	// handed contiguous spans of at most a row, or a whole tile in morton order for tiled buffers
+	template <typename DstT, int DstChannels, bool DstAllocateMem, typename ConvertFunc>
+	void ConvertTo(PixelBuffer<DstT, DstChannels, DstAllocateMem, false>& dst, ConvertFunc convert) const
+	{
+		assert(dst.GetWidth() == m_width && dst.GetHeight() == m_height);
+		DstT* dst_buffer = dst.GetBuffer();
+		const size_t row_size = (size_t)m_width * DstChannels;
+		if (!Tiled)
+		{
+#pragma omp parallel for schedule(static)
+			for (int y = 0; y < m_height; ++y)
+				convert(m_buffer + (size_t)y * m_width * NumChannels, dst_buffer + y * row_size, (size_t)m_width);
+			return;
+		}
+
+		DstT clear_value[DstChannels];
+		convert(m_clearValue, clear_value, 1);
+		const int tiles_x = m_tilesX;
+		const int tiles_y = m_tilesY;
+		// pixel pairs along x are adjacent in morton order
+		const int pair_offsets[PIXEL_TILE_SIZE / 2] = { 0, 4, 16, 20 };
+#pragma omp parallel for schedule(static)
+		for (int tile_y = 0; tile_y < tiles_y; ++tile_y)
+		{
+			DstT converted[PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * DstChannels];
+			for (int tile_x = 0; tile_x < tiles_x; ++tile_x)
 			{
-				for (int y = 0; y < m_height; ++y)
+				size_t tile_index = (size_t)tile_y * tiles_x + tile_x;
+				const T* tile = m_buffer + tile_index * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * NumChannels;
+				int x0 = tile_x * PIXEL_TILE_SIZE;
+				int y0 = tile_y * PIXEL_TILE_SIZE;
+				int tile_width = std::min(PIXEL_TILE_SIZE, m_width - x0);
+				int tile_height = std::min(PIXEL_TILE_SIZE, m_height - y0);
+				if (IsTileCleared(tile_index))
+				{
+					// never written since the clear, stream the clear value without touching the tile
+					for (int r = 0; r < tile_height; ++r)
+						FillSpan(dst_buffer + (size_t)(y0 + r) * row_size + (size_t)x0 * DstChannels, clear_value, tile_width);
+					continue;
+				}
+				convert(tile, converted, PIXEL_TILE_SIZE * PIXEL_TILE_SIZE);
+				for (int r = 0; r < tile_height; ++r)
 				{
-					SetColorBGR(x, y, color);
+					const DstT* src_row = converted + TileMortonIndex(0, r) * DstChannels;
+					DstT* dst_row = dst_buffer + (size_t)(y0 + r) * row_size + (size_t)x0 * DstChannels;
+					if (tile_width == PIXEL_TILE_SIZE)
+					{
+						for (int p = 0; p < PIXEL_TILE_SIZE / 2; ++p)
+							std::memcpy(dst_row + p * 2 * DstChannels, src_row + pair_offsets[p] * DstChannels, 2 * DstChannels * sizeof(DstT));
+					}
+					else
+					{
+						for (int x = 0; x < tile_width; ++x)
+							std::memcpy(dst_row + x * DstChannels, src_row + TileMortonIndex(x, 0) * DstChannels, DstChannels * sizeof(DstT));
+					}
 				}
 			}
+			_mm_sfence();
 		}
 	}
 
 	static constexpr int channels = NumChannels;
+	using value_type = T;
 
 protected:
+	void UpdateBufferSize()
+	{
+		m_bufferSize = ComputeBufferSize(m_width, m_height);
+		if (Tiled)
+		{
+			m_tilesX = (m_width + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE;
+			m_tilesY = (m_height + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE;
+			size_t num_tiles = (size_t)m_tilesX * m_tilesY;
+			// start out cleared to zero, so recycled memory reads the same as a fresh allocation
+			m_tileStates.reset(new std::atomic<uint8_t>[num_tiles]);
+			for (size_t i = 0; i < num_tiles; ++i)
+				m_tileStates[i].store(Tile_State_Cleared, std::memory_order_relaxed);
+		}
+	}
+
+	size_t GetTile(int x, int y) const
+	{
+		return (size_t)(y / PIXEL_TILE_SIZE) * m_tilesX + x / PIXEL_TILE_SIZE;
+	}
+
+	bool IsTileCleared(size_t tile) const
+	{
+		uint8_t state = m_tileStates[tile].load(std::memory_order_acquire);
+		while (state == Tile_State_Materializing)
+		{
+			_mm_pause();
+			state = m_tileStates[tile].load(std::memory_order_acquire);
+		}
+		return state == Tile_State_Cleared;
+	}
+
+	// the first writer fills the tile with the clear value, concurrent writers wait for it
+	void MaterializeTile(size_t tile)
+	{
+		if (m_tileStates[tile].load(std::memory_order_acquire) == Tile_State_Valid)
+			return;
+		uint8_t expected = Tile_State_Cleared;
+		if (m_tileStates[tile].compare_exchange_strong(expected, Tile_State_Materializing, std::memory_order_acquire))
+		{
+			T* pixels = m_buffer + tile * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * NumChannels;
+			for (int i = 0; i < PIXEL_TILE_SIZE * PIXEL_TILE_SIZE; ++i)
+				std::memcpy(pixels + i * NumChannels, m_clearValue, sizeof(m_clearValue));
+			m_tileStates[tile].store(Tile_State_Valid, std::memory_order_release);
+			return;
+		}
+		while (m_tileStates[tile].load(std::memory_order_acquire) != Tile_State_Valid)
+			_mm_pause();
+	}
+
+	// writes count copies of one pixel, with streaming stores when the span allows it
+	template <typename DstT, int DstChannels>
+	static void FillSpan(DstT* dst, const DstT (&pixel)[DstChannels], int count)
+	{
+		const size_t pixel_size = sizeof(pixel);
+		const size_t span_size = pixel_size * count;
+		if (16 % pixel_size == 0 && span_size % 16 == 0 && ((uintptr_t)dst & 15) == 0)
+		{
+			alignas(16) uint8_t pattern[16];
+			for (size_t i = 0; i < 16; i += pixel_size)
+				std::memcpy(pattern + i, pixel, pixel_size);
+			__m128i value = _mm_load_si128((const __m128i*)pattern);
+			for (size_t offset = 0; offset < span_size; offset += 16)
+				_mm_stream_si128((__m128i*)((uint8_t*)dst + offset), value);
+			return;
+		}
+		for (int i = 0; i < count; ++i)
+			std::memcpy(dst + i * DstChannels, pixel, pixel_size);
+	}
+
 	int m_width;
 	int m_height;
 	//int m_channels;
 	size_t m_bufferSize;
 	T* m_buffer = nullptr;
+	bool m_ownsBuffer = true;
 	//bool m_allocated;
+	int m_tilesX = 0;
+	int m_tilesY = 0;
+	std::unique_ptr<std::atomic<uint8_t>[]> m_tileStates;
+	T m_clearValue[NumChannels] = {};
 };
 
 using FrameBuffer = PixelBuffer<unsigned char, 4, false>;
+// render target with the frame buffer's format, copied to it on present
+using TiledFrameBuffer = PixelBuffer<unsigned char, 4, true, true>;
 using ColorBuffer = PixelBuffer<float, 4, true>;
-using DepthBuffer = PixelBuffer<float, 1, true>;
+using DepthBuffer = PixelBuffer<float, 1, true, true>;
 using StencilBuffer = PixelBuffer<unsigned char, 1, true>;
 
+// rgba16f render target, half the memory traffic of a ColorBuffer with enough range for hdr
+class HalfColorBuffer : public PixelBuffer<uint16_t, 4, true, true>
+{
+public:
+	HalfColorBuffer(int width, int height) : PixelBuffer(width, height) {}
+	HalfColorBuffer(int width, int height, uint16_t* buffer) : PixelBuffer(width, height, buffer) {}
+
+	Color GetColor(int x, int y) const
+	{
+		uint16_t half[4];
+		GetPixel(x, y, half);
+		Color color;
+		ConvertHalfToFloat(half, &color.x, 4);
+		return color;
+	}
+	void SetColor(int x, int y, const Color& color)
+	{
+		uint16_t half[4];
+		ConvertFloatToHalf(&color.x, half, 4);
+		SetPixel(x, y, half);
+	}
+	// bilinear with clamped coordinates, for binding the target as a shader resource
+	Color Sample(const float2& uv) const
+	{
+		float fx = uv.x * m_width - 0.5f;
+		float fy = uv.y * m_height - 0.5f;
+		int x0 = (int)std::floor(fx);
+		int y0 = (int)std::floor(fy);
+		float tx = fx - x0;
+		float ty = fy - y0;
+		int x1 = std::clamp(x0 + 1, 0, m_width - 1);
+		int y1 = std::clamp(y0 + 1, 0, m_height - 1);
+		x0 = std::clamp(x0, 0, m_width - 1);
+		y0 = std::clamp(y0, 0, m_height - 1);
+		Color c00 = GetColor(x0, y0);
+		Color c10 = GetColor(x1, y0);
+		Color c01 = GetColor(x0, y1);
+		Color c11 = GetColor(x1, y1);
+		return (c00 * (1.0f - tx) + c10 * tx) * (1.0f - ty) + (c01 * (1.0f - tx) + c11 * tx) * ty;
+	}
+};
+
 //struct DepthBuffer : public FrameBuffer
 //{
 //public:
@@ -0,0 +1,184 @@
+#include "pixel_convert.h"
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include "math/packing.h"
+
+#define SRGB_LUT_SIZE 4096
+
+const uint8_t* GetSRGBEncodeLUT();
+bool HasF16C();
+template <eTonemapOperator Operator>
+void TonemapSpan(float* colors, size_t count, float exposure);
+
+void ConvertToBGRA8(const Color* src, uint32_t* dst, size_t count, bool srgbEncode /* = false */)
+{
+	const float* src_floats = (const float*)src;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	size_t i = 0;
+	if (srgbEncode)
+	{
+		const uint8_t* lut = GetSRGBEncodeLUT();
+		const __m128 scale = _mm_setr_ps((float)(SRGB_LUT_SIZE - 1), (float)(SRGB_LUT_SIZE - 1), (float)(SRGB_LUT_SIZE - 1), 255.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i < count; ++i)
+		{
+			__m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src_floats + i * 4), zero), one);
+			alignas(16) int32_t q[4];
+			_mm_store_si128((__m128i*)q, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half)));
+			dst[i] = (uint32_t)lut[q[2]] | ((uint32_t)lut[q[1]] << 8) | ((uint32_t)lut[q[0]] << 16) | ((uint32_t)q[3] << 24);
+		}
+		return;
+	}
+
+	// truncates like the scalar float to uchar conversion did
+	const __m128 scale = _mm_set1_ps(255.0f);
+	auto convert = [&](size_t idx) -> __m128i
+	{
+		__m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src_floats + idx * 4), zero), one);
+		c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 1, 2));
+		return _mm_cvttps_epi32(_mm_mul_ps(c, scale));
+	};
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i p01 = _mm_packs_epi32(convert(i), convert(i + 1));
+		__m128i p23 = _mm_packs_epi32(convert(i + 2), convert(i + 3));
+		__m128i p45 = _mm_packs_epi32(convert(i + 4), convert(i + 5));
+		__m128i p67 = _mm_packs_epi32(convert(i + 6), convert(i + 7));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(p01, p23));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_packus_epi16(p45, p67));
+	}
+	for (; i < count; ++i)
+	{
+		__m128i p = _mm_packs_epi32(convert(i), _mm_setzero_si128());
+		dst[i] = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(p, p));
+	}
+}
+
+void ConvertHalfToFloat(const uint16_t* src, float* dst, size_t count)
+{
+	static const bool has_f16c = HasF16C();
+	size_t i = 0;
+	if (has_f16c)
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+			_mm_storeu_ps(dst + i, _mm_cvtph_ps(h));
+			_mm_storeu_ps(dst + i + 4, _mm_cvtph_ps(_mm_srli_si128(h, 8)));
+		}
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(dst + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(src + i))));
+	}
+	for (; i < count; ++i)
+		dst[i] = HalfToFloat(src[i]);
+}
+
+void ConvertFloatToHalf(const float* src, uint16_t* dst, size_t count)
+{
+	static const bool has_f16c = HasF16C();
+	size_t i = 0;
+	if (has_f16c)
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i lo = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+			__m128i hi = _mm_cvtps_ph(_mm_loadu_ps(src + i + 4), _MM_FROUND_TO_NEAREST_INT);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi64(lo, hi));
+		}
+		for (; i + 4 <= count; i += 4)
+			_mm_storel_epi64((__m128i*)(dst + i), _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+	for (; i < count; ++i)
+		dst[i] = FloatToHalf(src[i]);
+}
+
+void TonemapColors(Color* colors, size_t count, const TonemapDesc& desc)
+{
+	switch (desc.Operator)
+	{
+	case Tonemap_Operator_Reinhard:
+		TonemapSpan<Tonemap_Operator_Reinhard>(&colors[0].x, count, desc.Exposure);
+		break;
+	case Tonemap_Operator_ACES:
+		TonemapSpan<Tonemap_Operator_ACES>(&colors[0].x, count, desc.Exposure);
+		break;
+	default:
+		TonemapSpan<Tonemap_Operator_None>(&colors[0].x, count, desc.Exposure);
+		break;
+	}
+}
+
+template <eTonemapOperator Operator>
+void TonemapSpan(float* colors, size_t count, float exposure)
+{
+	// one pixel per register, the alpha lane is blended back in unchanged
+	const __m128 alpha_mask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+	const __m128 scale = _mm_set1_ps(exposure);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 a = _mm_set1_ps(2.51f);
+	const __m128 b = _mm_set1_ps(0.03f);
+	const __m128 c = _mm_set1_ps(2.43f);
+	const __m128 d = _mm_set1_ps(0.59f);
+	const __m128 e = _mm_set1_ps(0.14f);
+	for (size_t i = 0; i < count; ++i)
+	{
+		__m128 color = _mm_loadu_ps(colors + i * 4);
+		__m128 x = _mm_max_ps(_mm_mul_ps(color, scale), zero);
+		if (Operator == Tonemap_Operator_Reinhard)
+		{
+			// x / (1 + x)
+			x = _mm_div_ps(x, _mm_add_ps(x, one));
+		}
+		else if (Operator == Tonemap_Operator_ACES)
+		{
+			// x * (a * x + b) / (x * (c * x + d) + e)
+			__m128 num = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(a, x), b));
+			__m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(c, x), d)), e);
+			x = _mm_min_ps(_mm_div_ps(num, den), one);
+		}
+		else
+		{
+			x = _mm_min_ps(x, one);
+		}
+		_mm_storeu_ps(colors + i * 4, _mm_or_ps(_mm_and_ps(alpha_mask, color), _mm_andnot_ps(alpha_mask, x)));
+	}
+}
+
+bool HasF16C()
+{
+	// cpuid leaf 1, ecx bit 29
+	unsigned int regs[4] = {};
+#ifdef _MSC_VER
+	__cpuid((int*)regs, 1);
+#else
+	__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+	return (regs[2] & (1u << 29)) != 0;
+}
+
+const uint8_t* GetSRGBEncodeLUT()
+{
+	struct SRGBEncodeLUT
+	{
+		uint8_t Table[SRGB_LUT_SIZE];
+		SRGBEncodeLUT()
+		{
+			for (int i = 0; i < SRGB_LUT_SIZE; ++i)
+			{
+				float linear = (float)i / (SRGB_LUT_SIZE - 1);
+				float srgb = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+				Table[i] = (uint8_t)std::clamp((int)(srgb * 255.0f + 0.5f), 0, 255);
+			}
+		}
+	};
+	static const SRGBEncodeLUT lut;
+	return lut.Table;
+}
\ No newline at end of file
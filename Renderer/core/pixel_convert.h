@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "math/vec.h"
+
+enum eTonemapOperator
+{
+	Tonemap_Operator_None,
+	Tonemap_Operator_Reinhard,
+	// narkowicz's fit of the aces filmic curve
+	Tonemap_Operator_ACES
+};
+
+struct TonemapDesc
+{
+	eTonemapOperator Operator = Tonemap_Operator_ACES;
+	float Exposure = 1.0f;
+	bool SRGBEncode = false;
+};
+
+// saturates count colors to [0, 1] and packs them as bgra8, 8 pixels per iteration.
+// srgbEncode applies the srgb curve to rgb through a lookup table, alpha stays linear
+void ConvertToBGRA8(const Color* src, uint32_t* dst, size_t count, bool srgbEncode = false);
+
+// ieee half <-> float for count values, f16c when the cpu has it
+void ConvertHalfToFloat(const uint16_t* src, float* dst, size_t count);
+void ConvertFloatToHalf(const float* src, uint16_t* dst, size_t count);
+
+// scales rgb by the exposure and maps it to [0, 1] in place, alpha is left alone
+void TonemapColors(Color* colors, size_t count, const TonemapDesc& desc);
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "render_target_pool.h"
+#include <iostream>
+#include <cstdlib>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <malloc.h>
+#endif
+
+size_t AlignUp(size_t size, size_t alignment);
+
+RenderTargetPool::~RenderTargetPool()
+{
+	for (Block& block : m_blocks)
+	{
+		assert(!block.InUse);
+		FreeBlock(block);
+	}
+}
+
+void RenderTargetPool::EndFrame()
+{
+	++m_frame;
+	for (size_t i = 0; i < m_blocks.size();)
+	{
+		Block& block = m_blocks[i];
+		if (!block.InUse && m_frame - block.LastUsedFrame > RENDER_TARGET_MAX_IDLE_FRAMES)
+		{
+			FreeBlock(block);
+			block = m_blocks.back();
+			m_blocks.pop_back();
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void RenderTargetPool::Trim()
+{
+	for (size_t i = 0; i < m_blocks.size();)
+	{
+		if (!m_blocks[i].InUse)
+		{
+			FreeBlock(m_blocks[i]);
+			m_blocks[i] = m_blocks.back();
+			m_blocks.pop_back();
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+void* RenderTargetPool::AcquireMemory(size_t size)
+{
+	size = AlignUp(size, RENDER_TARGET_GRANULARITY);
+	// best fit among the free blocks, but don't waste more than half of a block
+	Block* best = nullptr;
+	for (Block& block : m_blocks)
+	{
+		if (block.InUse || block.Size < size || block.Size > size * 2)
+			continue;
+		if (best == nullptr || block.Size < best->Size)
+			best = &block;
+	}
+	if (best == nullptr)
+	{
+		Block block;
+		AllocateBlock(size, block);
+		if (block.Memory == nullptr)
+			return nullptr;
+		m_blocks.push_back(block);
+		best = &m_blocks.back();
+	}
+	best->InUse = true;
+	best->LastUsedFrame = m_frame;
+	return best->Memory;
+}
+
+void RenderTargetPool::ReleaseMemory(void* memory)
+{
+	for (Block& block : m_blocks)
+	{
+		if (block.Memory == memory)
+		{
+			assert(block.InUse);
+			block.InUse = false;
+			block.LastUsedFrame = m_frame;
+			return;
+		}
+	}
+	assert(false && "memory doesn't belong to this pool");
+}
+
+void RenderTargetPool::AllocateBlock(size_t size, Block& block)
+{
+	block.Memory = nullptr;
+	block.Size = size;
+	block.LastUsedFrame = m_frame;
+	block.InUse = false;
+	block.LargePage = false;
+#ifdef _WIN32
+	size_t large_page_size = m_largePages ? GetLargePageMinimum() : 0;
+	if (large_page_size > 0)
+	{
+		size_t large_size = AlignUp(size, large_page_size);
+		block.Memory = VirtualAlloc(nullptr, large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (block.Memory != nullptr)
+		{
+			block.Size = large_size;
+			block.LargePage = true;
+			return;
+		}
+		std::cout << "Large pages are unavailable, render targets use normal pages" << std::endl;
+		m_largePages = false;
+	}
+	block.Memory = _aligned_malloc(size, RENDER_TARGET_ALIGNMENT);
+#else
+	block.Memory = std::aligned_alloc(RENDER_TARGET_ALIGNMENT, size);
+#endif
+	if (block.Memory == nullptr)
+		std::cout << "Render target allocate fail! " << size << " bytes" << std::endl;
+}
+
+void RenderTargetPool::FreeBlock(Block& block)
+{
+#ifdef _WIN32
+	if (block.LargePage)
+		VirtualFree(block.Memory, 0, MEM_RELEASE);
+	else
+		_aligned_free(block.Memory);
+#else
+	std::free(block.Memory);
+#endif
+	block.Memory = nullptr;
+}
+
+size_t AlignUp(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "pixel_buffer.h"
+
+#define RENDER_TARGET_ALIGNMENT 64
+// blocks are rounded up to this so slightly different sizes can share them
+#define RENDER_TARGET_GRANULARITY (64 * 1024)
+#define RENDER_TARGET_MAX_IDLE_FRAMES 8
+
+// hands out render target memory, reusing blocks released earlier. targets whose lifetimes
+// don't overlap share memory whatever their format, and resizes don't page fault fresh allocations.
+// the contents of a linear target are undefined until it is cleared, tiled targets start cleared to zero
+class RenderTargetPool
+{
+public:
+	// large pages need the lock pages in memory privilege on windows, without it the pool falls back to normal pages
+	RenderTargetPool(bool largePages = false) : m_largePages(largePages) {}
+	~RenderTargetPool();
+	RenderTargetPool(const RenderTargetPool&) = delete;
+	RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+	// nullptr if the memory can't be allocated
+	template <typename BufferType>
+	BufferType* Acquire(int width, int height)
+	{
+		using ValueType = typename BufferType::value_type;
+		void* memory = AcquireMemory(BufferType::ComputeBufferSize(width, height) * sizeof(ValueType));
+		if (memory == nullptr)
+			return nullptr;
+		return new BufferType(width, height, (ValueType*)memory);
+	}
+	// draws execute immediately, so a target can go back as soon as the last pass reading it is drawn
+	template <typename BufferType>
+	void Release(BufferType*& target)
+	{
+		if (target == nullptr)
+			return;
+		ReleaseMemory(target->GetBuffer());
+		delete target;
+		target = nullptr;
+	}
+	// frees blocks that haven't been reused for RENDER_TARGET_MAX_IDLE_FRAMES frames
+	void EndFrame();
+	// frees every block not in use
+	void Trim();
+
+private:
+	struct Block
+	{
+		void* Memory;
+		size_t Size;
+		uint32_t LastUsedFrame;
+		bool InUse;
+		bool LargePage;
+	};
+
+	void* AcquireMemory(size_t size);
+	void ReleaseMemory(void* memory);
+	void AllocateBlock(size_t size, Block& block);
+	void FreeBlock(Block& block);
+
+	std::vector<Block> m_blocks;
+	uint32_t m_frame = 0;
+	bool m_largePages;
+};
\ No newline at end of file
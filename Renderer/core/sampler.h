@@ -1,9 +1,24 @@
 #pragma once
+#include <cstdint>
 #include "math/math.h"
 
+class Texture;
+struct SamplerState;
+
+// sampling specialized on the filter and address modes of a sampler, set by SamplerState::Compile
+using SampleLevelFunc = Color (*)(const Texture& texture, const SamplerState& sampler, const float2& uv, float level);
+using SampleLevel4Func = void (*)(const Texture& texture, const SamplerState& sampler, const float2* uv, float level, Color* colors);
+using SampleFunc = Color (*)(const Texture& texture, const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy);
+
 enum eFilter
 {
-	Filter_Min_Mag_Linear_Mip_Point
+	// nearest texel of the nearest mip, for full screen passes and lookup tables
+	Filter_Min_Mag_Mip_Point,
+	Filter_Min_Mag_Linear_Mip_Point,
+	// trilinear
+	Filter_Min_Mag_Mip_Linear,
+	// trilinear taps along the major axis of the pixel footprint, up to MaxAnisotropy
+	Filter_Anisotropic
 };
 
 enum eAddressMode
@@ -17,8 +32,30 @@ enum eAddressMode
 
 struct SamplerState
 {
-	eFilter Filter;
-	eAddressMode AddressU;
-	eAddressMode AddressV;
+	// compiled for the default fields, so a sampler is usable as soon as it's created
+	SamplerState() { Compile(); }
+
+	eFilter Filter = Filter_Min_Mag_Linear_Mip_Point;
+	eAddressMode AddressU = Address_Mode_Warp;
+	eAddressMode AddressV = Address_Mode_Warp;
 	Color BorderColor;
+	// added to the level of detail computed from the uv derivatives
+	float MipLODBias = 0.0f;
+	// tap budget of Filter_Anisotropic, 1 to 16. footprints closer to square use fewer taps
+	uint32_t MaxAnisotropy = 16;
+
+	// picks the sampling functions for the filter and address modes, so samples don't branch on them.
+	// call it again after changing them, defined with the sampling code in texture.cpp
+	void Compile();
+	// false once the filter or an address mode changed since the last Compile
+	bool IsCompiled() const
+	{
+		return CompiledFilter == Filter && CompiledAddressU == AddressU && CompiledAddressV == AddressV;
+	}
+	SampleLevelFunc pSampleLevel = nullptr;
+	SampleLevel4Func pSampleLevel4 = nullptr;
+	SampleFunc pSample = nullptr;
+	eFilter CompiledFilter;
+	eAddressMode CompiledAddressU;
+	eAddressMode CompiledAddressV;
 };
\ No newline at end of file
@@ -3,12 +3,27 @@
 #include <fstream>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <atomic>
+#include <emmintrin.h>
+#include "texture_compression.h"
+#include "virtual_texture.h"
 
-void ImageFlipH(Texture* texture);
-void ImageFlipV(Texture* texture);
-float ResolveTexCoord(eAddressMode addressMode, float x);
-float2 ResolveTexCoord(eAddressMode addressModeU, eAddressMode addressModeV, const float2& uv);
+#define DECODED_BLOCK_CACHE_SIZE 256
+// texels per axis tested by IsTangentSpaceNormalMap
+#define NORMAL_MAP_TEST_SAMPLES 64
+
+template <eAddressMode Mode>
+int ResolveTexel(int x, int dim);
+template <eAddressMode Mode>
+bool IsBorder(float x);
 int Warp(int x, int dim);
+int GetTexelSize(eTextureFormat format);
+bool IsBlockCompressed(eTextureFormat format);
+uint32_t NewBufferId();
+Color UnpackTexelRGBA8(uint32_t texel);
+int FloorToInt(float x);
+Color BlendFootprint(const Color* colors, float alpha, float beta);
 
 Texture::Texture() : m_width(0), m_height(0), m_channels(0), m_buffer(nullptr), m_size(0)
 {
@@ -26,275 +41,860 @@ Texture::~Texture()
 	{
 		delete[] m_buffer;
 	}
+	ReleasePages();
 }
 
 void Texture::LoadFromTGA(const std::string& path)
 {
-	int width, height, channels;
-	int is_rle, flip_h, origin_left_upper;
-	std::ifstream fs;
-	fs.open(path, std::ios::binary);
+	// the whole file in one read, packets are decoded straight from memory
+	std::ifstream fs(path, std::ios::binary | std::ios::ate);
 	if (!fs.is_open())
 	{
 		std::cout << "fail to open " << path << std::endl;
 		return;
 	}
+	std::vector<unsigned char> file((size_t)fs.tellg());
+	fs.seekg(0);
+	fs.read((char*)file.data(), file.size());
+	fs.close();
+	if (file.size() < TGA_HEADER_SIZE)
+	{
+		std::cout << "invalid tga " << path << std::endl;
+		return;
+	}
 
-	int depth, idlength, imgtype, imgdesc;
+	int width, height, channels;
+	int is_rle, flip_h, origin_left_upper;
+	size_t data_offset;
 	// read tga header
 	{
-		char header[TGA_HEADER_SIZE];
-		fs.read(header, TGA_HEADER_SIZE);
-
+		const unsigned char* header = file.data();
 		width = header[12] | (header[13] << 8);
 		height = header[14] | (header[15] << 8);
 		assert(width > 0 && height > 0);
-		depth = header[16];
+		int depth = header[16];
 		assert(depth == 8 || depth == 24 || depth == 32);
 		channels = depth / 8;
 
-		idlength = header[0];
-		assert(idlength == 0);
+		// image id, skipped
+		data_offset = TGA_HEADER_SIZE + header[0];
 
-		imgtype = header[2];
+		int imgtype = header[2];
 		assert(imgtype == 2 || imgtype == 3 || imgtype == 10 || imgtype == 11);
 		is_rle = imgtype == 10 || imgtype == 11;
 
-		imgdesc = header[17];
+		int imgdesc = header[17];
 		flip_h = imgdesc & 0x10;
 		origin_left_upper = imgdesc & 0x20;
 	}
 
 	Create(width, height, channels);
 
+	// every pixel goes straight to its flipped place in the tiles, bgr(a) or grey to rgba on the way
+	auto to_rgba = [channels](const unsigned char* src) -> uint32_t
+	{
+		if (channels == 1)
+			return src[0] | (src[0] << 8) | (src[0] << 16) | 0xFF000000u;
+		return src[2] | (src[1] << 8) | (src[0] << 16) | (channels == 4 ? (uint32_t)src[3] << 24 : 0xFF000000u);
+	};
+	auto store = [=](int x, int y, uint32_t texel)
+	{
+		*(uint32_t*)(m_buffer + GetTexelIndex(flip_h ? width - 1 - x : x, origin_left_upper ? height - 1 - y : y, 0)) = texel;
+	};
+
 	if (is_rle)
 	{
-		int cur_size = 0;
-		while (cur_size < m_size)
+		// packets may run across rows, find the packet each row starts in and how much of it the previous row used
+		struct RowStart
 		{
-			unsigned char header;
-			header = fs.get();
-			int rle_packet = header & 0x80;
-			int num_pixels = (header & 0x7F) + 1;
-			unsigned char pixel[4];
-			int i, j;
-			assert(cur_size + num_pixels * m_channels <= m_size);
-			if (rle_packet) {                                   /* rle packet */
-				for (j = 0; j < m_channels; j++) {
-					pixel[j] = fs.get();
-				}
-				for (i = 0; i < num_pixels; i++) {
-					for (j = 0; j < m_channels; j++) {
-						m_buffer[cur_size++] = pixel[j];
-					}
+			size_t Offset;
+			int Skip;
+		};
+		std::vector<RowStart> row_starts(height);
+		size_t offset = data_offset;
+		size_t pixel = 0;
+		int rows = 0;
+		while (pixel < (size_t)width * height && offset < file.size())
+		{
+			size_t count = (file[offset] & 0x7F) + 1;
+			size_t packet_size = 1 + (file[offset] & 0x80 ? channels : count * channels);
+			if (offset + packet_size > file.size())
+				break;
+			for (; rows < height && (size_t)rows * width < pixel + count; ++rows)
+				row_starts[rows] = { offset, (int)((size_t)rows * width - pixel) };
+			pixel += count;
+			offset += packet_size;
+		}
+		if (pixel < (size_t)width * height)
+			std::cout << "truncated tga " << path << std::endl;
+
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < rows; ++y)
+		{
+			size_t offset = row_starts[y].Offset;
+			int skip = row_starts[y].Skip;
+			int x = 0;
+			while (x < width)
+			{
+				int count = (file[offset] & 0x7F) + 1;
+				bool rle_packet = file[offset] & 0x80;
+				size_t packet_size = 1 + (rle_packet ? channels : (size_t)count * channels);
+				if (offset + packet_size > file.size())
+					break;
+				int num_pixels = std::min(count - skip, width - x);
+				if (rle_packet)
+				{
+					uint32_t texel = to_rgba(&file[offset + 1]);
+					for (int i = 0; i < num_pixels; ++i)
+						store(x + i, y, texel);
 				}
-			}
-			else {                                            /* raw packet */
-				for (i = 0; i < num_pixels; i++) {
-					for (j = 0; j < m_channels; j++) {
-						m_buffer[cur_size++] = fs.get();
-					}
+				else
+				{
+					const unsigned char* src = &file[offset + 1 + (size_t)skip * channels];
+					for (int i = 0; i < num_pixels; ++i)
+						store(x + i, y, to_rgba(src + (size_t)i * channels));
 				}
+				x += num_pixels;
+				skip = 0;
+				offset += packet_size;
 			}
 		}
 	}
 	else
 	{
-		fs.read((char*)m_buffer, m_size);
+		size_t row_size = (size_t)width * channels;
+		int rows = (int)std::min<size_t>(height, (file.size() - std::min(data_offset, file.size())) / row_size);
+		if (rows < height)
+			std::cout << "truncated tga " << path << std::endl;
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < rows; ++y)
+		{
+			const unsigned char* src = &file[data_offset + y * row_size];
+			for (int x = 0; x < width; ++x)
+				store(x, y, to_rgba(src + (size_t)x * channels));
+		}
 	}
+	GenerateMips();
+}
 
-	fs.close();
+void Texture::Create(int width, int height, int channels, eTextureFormat format /* = Texture_Format_RGBA8 */)
+{
+	if (m_buffer != nullptr)
+		delete[] m_buffer;
+	ReleasePages();
+	m_width = width;
+	m_height = height;
+	m_channels = channels;
+	m_format = format;
+	m_texelSize = GetTexelSize(format);
+	m_mips.assign(1, MakeMipLevel(width, height, 0));
+	m_size = m_mips[0].Size;
+	m_buffer = new unsigned char[m_size]();
+	m_bufferId = NewBufferId();
+}
 
-	if (flip_h)
+void Texture::GenerateMips()
+{
+	if (IsBlockCompressed(m_format) || m_pageCache != nullptr)
 	{
-		ImageFlipH(this);
+		std::cout << "can't generate mips of block compressed or virtual texture " << m_name << std::endl;
+		return;
+	}
+	m_mips.resize(1);
+	size_t size = m_mips[0].Size;
+	while (m_mips.back().Width > 1 || m_mips.back().Height > 1)
+	{
+		m_mips.push_back(MakeMipLevel(std::max(m_mips.back().Width / 2, 1), std::max(m_mips.back().Height / 2, 1), size));
+		size += m_mips.back().Size;
 	}
-	if (origin_left_upper)
+
+	unsigned char* buffer = new unsigned char[size]();
+	std::memcpy(buffer, m_buffer, m_mips[0].Size);
+	delete[] m_buffer;
+	m_buffer = buffer;
+	m_size = size;
+	m_bufferId = NewBufferId();
+
+	for (int level = 1; level < (int)m_mips.size(); ++level)
 	{
-		ImageFlipV(this);
+		const MipLevel& src = m_mips[level - 1];
+		const MipLevel& dst = m_mips[level];
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < dst.Height; ++y)
+		{
+			// odd sizes repeat the last row or column
+			int y0 = std::min(y * 2, src.Height - 1);
+			int y1 = std::min(y * 2 + 1, src.Height - 1);
+			for (int x = 0; x < dst.Width; ++x)
+			{
+				int x0 = std::min(x * 2, src.Width - 1);
+				int x1 = std::min(x * 2 + 1, src.Width - 1);
+				if (m_format == Texture_Format_RGBA8)
+				{
+					const unsigned char* t00 = m_buffer + GetTexelIndex(x0, y0, level - 1);
+					const unsigned char* t10 = m_buffer + GetTexelIndex(x1, y0, level - 1);
+					const unsigned char* t01 = m_buffer + GetTexelIndex(x0, y1, level - 1);
+					const unsigned char* t11 = m_buffer + GetTexelIndex(x1, y1, level - 1);
+					unsigned char* texel = m_buffer + GetTexelIndex(x, y, level);
+					for (int c = 0; c < 4; ++c)
+						texel[c] = (unsigned char)((t00[c] + t10[c] + t01[c] + t11[c] + 2) / 4);
+				}
+				else
+				{
+					Color colors[4];
+					LoadFootprint(x0, y0, x1, y1, level - 1, colors);
+					StoreTexel(GetTexelIndex(x, y, level), (colors[0] + colors[1] + colors[2] + colors[3]) * 0.25f);
+				}
+			}
+		}
+	}
+}
+
+void Texture::ConvertFormat(eTextureFormat format)
+{
+	if (format == m_format)
+		return;
+	if (m_pageCache != nullptr)
+	{
+		std::cout << "can't convert virtual texture " << m_name << std::endl;
+		return;
+	}
+	Texture converted;
+	converted.m_format = format;
+	converted.m_texelSize = GetTexelSize(format);
+	if (!IsBlockCompressed(m_format) && !IsBlockCompressed(format))
+	{
+		// same tiles, the layout only scales with the texel size
+		size_t num_texels = m_size / m_texelSize;
+		converted.m_size = num_texels * converted.m_texelSize;
+		converted.m_buffer = new unsigned char[converted.m_size];
+#pragma omp parallel for schedule(static)
+		for (int64_t i = 0; i < (int64_t)num_texels; ++i)
+			converted.StoreTexel(i * converted.m_texelSize, LoadTexel(m_buffer + i * m_texelSize));
+		converted.m_mips = m_mips;
+		for (MipLevel& mip : converted.m_mips)
+		{
+			mip.Offset = mip.Offset / m_texelSize * converted.m_texelSize;
+			mip.Size = mip.Size / m_texelSize * converted.m_texelSize;
+		}
+	}
+	else
+	{
+		for (const MipLevel& mip : m_mips)
+		{
+			converted.m_mips.push_back(converted.MakeMipLevel(mip.Width, mip.Height, converted.m_size));
+			converted.m_size += converted.m_mips.back().Size;
+		}
+		converted.m_buffer = new unsigned char[converted.m_size]();
+		for (int level = 0; level < (int)m_mips.size(); ++level)
+		{
+			const MipLevel& mip = converted.m_mips[level];
+			if (IsBlockCompressed(format))
+			{
+				int blocks_y = (mip.Height + 3) / 4;
+#pragma omp parallel for schedule(static)
+				for (int block_y = 0; block_y < blocks_y; ++block_y)
+				{
+					for (int block_x = 0; block_x < mip.TilesX; ++block_x)
+					{
+						// blocks over the edge repeat the last row or column
+						uint32_t texels[16];
+						for (int i = 0; i < 16; ++i)
+							texels[i] = LoadPackedTexel(std::min(block_x * 4 + (i & 3), mip.Width - 1), std::min(block_y * 4 + i / 4, mip.Height - 1), level);
+						uint8_t* block = converted.m_buffer + mip.Offset + ((size_t)block_y * mip.TilesX + block_x) * converted.m_texelSize;
+						if (format == Texture_Format_BC1)
+							EncodeBC1(texels, block);
+						else if (format == Texture_Format_BC3)
+							EncodeBC3(texels, block);
+						else
+							EncodeBC5(texels, block);
+					}
+				}
+			}
+			else
+			{
+#pragma omp parallel for schedule(static)
+				for (int y = 0; y < mip.Height; ++y)
+				{
+					for (int x = 0; x < mip.Width; ++x)
+						converted.StoreTexel(converted.GetTexelIndex(x, y, level), GetColor(x, y, level));
+				}
+			}
+		}
 	}
-	if (m_channels >= 3)
+
+	std::swap(m_buffer, converted.m_buffer);
+	std::swap(m_mips, converted.m_mips);
+	m_size = converted.m_size;
+	m_format = format;
+	m_texelSize = converted.m_texelSize;
+	m_bufferId = NewBufferId();
+}
+
+void Texture::MakeVirtual(VirtualTextureCache* cache)
+{
+	if (m_pageCache != nullptr || m_buffer == nullptr)
+		return;
+	// pages hold whole tiles, or blocks for bc formats, in the same order as a mip
+	bool block_compressed = IsBlockCompressed(m_format);
+	int tile_size = block_compressed ? 4 : PIXEL_TILE_SIZE;
+	size_t tile_bytes = block_compressed ? m_texelSize : (size_t)PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * m_texelSize;
+	int page_tiles = VIRTUAL_TEXTURE_PAGE_SIZE / tile_size;
+	size_t page_bytes = page_tiles * page_tiles * tile_bytes;
+	std::vector<unsigned char> pages;
+	for (int level = 0; level < (int)m_mips.size(); ++level)
 	{
-		int x, y;
-		for (y = 0; y < m_height; ++y)
+		MipLevel& mip = m_mips[level];
+		int tiles_y = (mip.Height + tile_size - 1) / tile_size;
+		mip.PagesX = (mip.Width + VIRTUAL_TEXTURE_PAGE_SIZE - 1) / VIRTUAL_TEXTURE_PAGE_SIZE;
+		int pages_y = (mip.Height + VIRTUAL_TEXTURE_PAGE_SIZE - 1) / VIRTUAL_TEXTURE_PAGE_SIZE;
+		pages.assign(page_bytes * mip.PagesX * pages_y, 0);
+#pragma omp parallel for schedule(static)
+		for (int tile_y = 0; tile_y < tiles_y; ++tile_y)
 		{
-			for (x = 0; x < m_width; ++x)
+			int page_y = tile_y / page_tiles;
+			for (int page_x = 0; page_x < mip.PagesX; ++page_x)
 			{
-				auto pixel = GetRawValue(x, y);
-				std::swap(pixel.x, pixel.z);
-				// bgr to rgb
-				SetRawValue(x, y, pixel);
+				int tile_x = page_x * page_tiles;
+				int count = std::min(page_tiles, mip.TilesX - tile_x);
+				unsigned char* dst = pages.data() + ((size_t)page_y * mip.PagesX + page_x) * page_bytes + (tile_y % page_tiles) * page_tiles * tile_bytes;
+				std::memcpy(dst, m_buffer + mip.Offset + ((size_t)tile_y * mip.TilesX + tile_x) * tile_bytes, count * tile_bytes);
 			}
 		}
+		// the mip tail fits in one page and stays resident, it's what sampling falls back to
+		mip.FirstPage = cache->AddPages(pages.data(), page_bytes, mip.PagesX * pages_y, level, mip.PagesX == 1 && pages_y == 1);
 	}
+	delete[] m_buffer;
+	m_buffer = nullptr;
+	m_pageCache = cache;
+}
 
+void Texture::ReleasePages()
+{
+	if (m_pageCache == nullptr)
+		return;
+	for (const MipLevel& mip : m_mips)
+		m_pageCache->ReleasePages(mip.FirstPage, mip.PagesX * ((mip.Height + VIRTUAL_TEXTURE_PAGE_SIZE - 1) / VIRTUAL_TEXTURE_PAGE_SIZE));
+	m_pageCache = nullptr;
 }
 
-void Texture::Create(int width, int height, int channels)
+Texture::MipLevel Texture::MakeMipLevel(int width, int height, size_t offset) const
 {
-	if (m_buffer != nullptr)
-		delete[] m_buffer;
-	m_width = width;
-	m_height = height;
-	m_channels = channels;
-	m_size = width * height * channels;
-	m_buffer = new unsigned char[m_size]();
+	MipLevel mip;
+	mip.Width = width;
+	mip.Height = height;
+	mip.Offset = offset;
+	mip.PagesX = 0;
+	mip.FirstPage = 0;
+	if (IsBlockCompressed(m_format))
+	{
+		mip.TilesX = (width + 3) / 4;
+		mip.Size = (size_t)mip.TilesX * ((height + 3) / 4) * m_texelSize;
+		return mip;
+	}
+	mip.TilesX = (width + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE;
+	mip.Size = (size_t)mip.TilesX * ((height + PIXEL_TILE_SIZE - 1) / PIXEL_TILE_SIZE) * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE * m_texelSize;
+	return mip;
 }
 
 Vec4<unsigned char> Texture::GetRawValue(int x, int y)
 {
-	int index = (y * m_width + x) * m_channels;
-	Vec4<unsigned char> raw;
-	raw.x = m_buffer[index];
-	raw.y = m_buffer[index + 1];
-	raw.z = m_buffer[index + 2];
-	raw.w = m_channels == 4 ? m_buffer[index + 3] : 255;
-	return raw;
+	if (m_format != Texture_Format_RGBA8 || m_pageCache != nullptr)
+	{
+		Color col = GetColor(x, y);
+		return Vec4<unsigned char>(std::clamp(col.x, 0.0f, 1.0f) * 255 + 0.5f, std::clamp(col.y, 0.0f, 1.0f) * 255 + 0.5f,
+			std::clamp(col.z, 0.0f, 1.0f) * 255 + 0.5f, std::clamp(col.w, 0.0f, 1.0f) * 255 + 0.5f);
+	}
+	size_t index = GetTexelIndex(x, y, 0);
+	return Vec4<unsigned char>(m_buffer[index], m_buffer[index + 1], m_buffer[index + 2], m_buffer[index + 3]);
 }
 
 void Texture::SetRawValue(int x, int y, const Vec4<unsigned char>& raw)
 {
-	int index = (y * m_width + x) * m_channels;
+	if (m_format != Texture_Format_RGBA8 || m_pageCache != nullptr)
+	{
+		SetColor(x, y, Color(raw.x, raw.y, raw.z, raw.w) / 255.0f);
+		return;
+	}
+	size_t index = GetTexelIndex(x, y, 0);
 	m_buffer[index] = raw.x;
 	m_buffer[index + 1] = raw.y;
 	m_buffer[index + 2] = raw.z;
-	if (m_channels == 4)
-		m_buffer[index + 3] = raw.w;
+	m_buffer[index + 3] = raw.w;
 }
 
-float4 Texture::GetColor(int x, int y) const
+float4 Texture::GetColor(int x, int y, int level /* = 0 */) const
 {
-	int index = (y * m_width + x) * m_channels;
-	float4 col;
-	col.x = (float)m_buffer[index] / (float)255;
-	col.y = (float)m_buffer[index + 1] / (float)255;
-	col.z = (float)m_buffer[index + 2] / (float)255;
-	col.w = m_channels == 4 ? (float)m_buffer[index + 3] / (float)255 : 1.0f;
-	return col;
+	if (IsBlockCompressed(m_format))
+		return UnpackTexelRGBA8(LoadPackedTexel(x, y, level));
+	return LoadTexel(GetTexelAddress(x, y, level));
 }
 
 void Texture::SetColor(int x, int y, const float4& col)
 {
-	int index = (y * m_width + x) * m_channels;
-	m_buffer[index] = std::clamp(col.x, 0.0f, 1.0f) * 255;
-	m_buffer[index + 1] = std::clamp(col.y, 0.0f, 1.0f) * 255;
-	m_buffer[index + 2] = std::clamp(col.z, 0.0f, 1.0f) * 255;
-	if (m_channels == 4)
-		m_buffer[index + 3] = std::clamp(col.w, 0.0f, 1.0f) * 255;
-}
-
-Color Texture::SampleLevel(const SamplerState& sampler, const float2& uv, int level) const
-{
-	float2 r_uv = ResolveTexCoord(sampler.AddressU, sampler.AddressV, uv);
-	if (r_uv >= float2(0.0f, 0.0f) && r_uv <= float2(1.0f, 1.0f))
-	{
-		float2 xy = uv * float2(m_width, m_height);
-		int x0 = Warp((int)(xy.x - 0.5f), m_width);
-		int y0 = Warp((int)(xy.y - 0.5f), m_height);
-		int x1 = Warp((int)(xy.x - 0.5f) + 1, m_width);
-		int y1 = Warp((int)(xy.y - 0.5f) + 1, m_height);
-		float alpha = std::fmod(xy.x - 0.5f, 1.0);
-		float beta = std::fmod(xy.y - 0.5f, 1.0);
-		Color c00 = GetColor(x0, y0);
-		Color c01 = GetColor(x0, y1);
-		Color c10 = GetColor(x1, y0);
-		Color c11 = GetColor(x1, y1);
-		Color c_t = c00 * (1.0f - alpha) + c10 * alpha;
-		Color c_b = c01 * (1.0f - alpha) + c11 * alpha;
-		return c_t * (1.0f - beta) + c_b * beta;
-	}
-	else
+	if (IsBlockCompressed(m_format) || m_pageCache != nullptr)
 	{
-		return sampler.BorderColor;
+		std::cout << "can't write to block compressed or virtual texture " << m_name << std::endl;
+		return;
 	}
+	StoreTexel(GetTexelIndex(x, y, 0), col);
 }
 
-void ImageFlipH(Texture* texture)
+bool Texture::IsTangentSpaceNormalMap() const
 {
-	int half_width = texture->GetWidth() / 2;
-	int x, y, k;
-	for (y = 0; y < texture->GetHeight(); y++) 
+	if (m_width == 0 || m_height == 0)
+		return false;
+	// a grid of texels from level 0, nearly all of them have to be unit length normals and some must not be gray
+	int step_x = std::max(m_width / NORMAL_MAP_TEST_SAMPLES, 1);
+	int step_y = std::max(m_height / NORMAL_MAP_TEST_SAMPLES, 1);
+	int num_samples = 0;
+	int num_normals = 0;
+	bool colored = false;
+	for (int y = step_y / 2; y < m_height; y += step_y)
 	{
-		for (x = 0; x < half_width; x++) 
+		for (int x = step_x / 2; x < m_width; x += step_x)
 		{
-			int flipped_x = texture->GetWidth() - 1 - x;
-			auto pixel1 = texture->GetRawValue(x, y);
-			auto pixel2 = texture->GetRawValue(flipped_x, y);
-			for (k = 0; k < texture->GetChannels(); k++) 
-			{
-				texture->SetRawValue(x, y, pixel2);
-				texture->SetRawValue(flipped_x, y, pixel1);
-			}
-			
+			float4 c = GetColor(x, y, 0);
+			float3 n(c.x * 2.0f - 1.0f, c.y * 2.0f - 1.0f, c.z * 2.0f - 1.0f);
+			float length = (float)n.Length();
+			num_normals += (n.z > 0.0f && length > 0.8f && length < 1.2f) ? 1 : 0;
+			colored |= std::abs(c.x - c.z) > 0.05f || std::abs(c.y - c.z) > 0.05f;
+			++num_samples;
 		}
 	}
+	return colored && num_normals * 10 >= num_samples * 9;
+}
+
+Color Texture::LoadTexel(const unsigned char* texel) const
+{
+	Color col;
+	switch (m_format)
+	{
+	case Texture_Format_RGBA8:
+		col = UnpackTexelRGBA8(*(const uint32_t*)texel);
+		break;
+	case Texture_Format_RGBA16F:
+		ConvertHalfToFloat((const uint16_t*)texel, &col.x, 4);
+		break;
+	default:
+		std::memcpy(&col.x, texel, sizeof(float) * 4);
+		break;
+	}
+	return col;
 }
 
-void ImageFlipV(Texture* texture)
+void Texture::StoreTexel(size_t index, const Color& color)
 {
-	int half_height = texture->GetHeight() / 2;
-	int x, y, k;
-	for (y = 0; y < half_height; y++) 
+	switch (m_format)
 	{
-		for (x = 0; x < texture->GetWidth(); x++) 
+	case Texture_Format_RGBA8:
+		// rounded so converting back from a float format is lossless
+		m_buffer[index] = (unsigned char)(std::clamp(color.x, 0.0f, 1.0f) * 255 + 0.5f);
+		m_buffer[index + 1] = (unsigned char)(std::clamp(color.y, 0.0f, 1.0f) * 255 + 0.5f);
+		m_buffer[index + 2] = (unsigned char)(std::clamp(color.z, 0.0f, 1.0f) * 255 + 0.5f);
+		m_buffer[index + 3] = (unsigned char)(std::clamp(color.w, 0.0f, 1.0f) * 255 + 0.5f);
+		break;
+	case Texture_Format_RGBA16F:
+		ConvertFloatToHalf(&color.x, (uint16_t*)(m_buffer + index), 4);
+		break;
+	default:
+		std::memcpy(m_buffer + index, &color.x, sizeof(float) * 4);
+		break;
+	}
+}
+
+uint32_t Texture::LoadPackedTexel(int x, int y, int level) const
+{
+	if (m_format == Texture_Format_RGBA8)
+		return *(const uint32_t*)GetTexelAddress(x, y, level);
+	if (!IsBlockCompressed(m_format))
+	{
+		Color col = LoadTexel(GetTexelAddress(x, y, level));
+		float rgba[4] = { col.x, col.y, col.z, col.w };
+		uint32_t texel = 0;
+		for (int c = 0; c < 4; ++c)
+			texel |= (uint32_t)(std::clamp(rgba[c], 0.0f, 1.0f) * 255 + 0.5f) << (c * 8);
+		return texel;
+	}
+
+	// direct mapped, keyed by the block's place in the buffer
+	struct DecodedBlockCache
+	{
+		uint64_t Keys[DECODED_BLOCK_CACHE_SIZE] = {};
+		uint32_t Texels[DECODED_BLOCK_CACHE_SIZE][16];
+	};
+	thread_local DecodedBlockCache cache;
+	// pages hold the same blocks whenever they are resident, so they share the keys of the whole texture
+	const unsigned char* page = m_pageCache != nullptr ? GetResidentPage(x, y, level) : nullptr;
+	const MipLevel& mip = m_mips[level];
+	size_t offset = mip.Offset + ((size_t)(y / 4) * mip.TilesX + x / 4) * m_texelSize;
+	uint64_t key = ((uint64_t)m_bufferId << 40) | offset;
+	size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (DECODED_BLOCK_CACHE_SIZE - 1);
+	if (cache.Keys[slot] != key)
+	{
+		const uint8_t* block = m_buffer + offset;
+		if (page != nullptr)
 		{
-			int flipped_y = texture->GetHeight() - 1 - y;
-			auto pixel1 = texture->GetRawValue(x, y);
-			auto pixel2 = texture->GetRawValue(x, flipped_y);
-			for (k = 0; k < texture->GetChannels(); k++) 
-			{
-				texture->SetRawValue(x, y, pixel2);
-				texture->SetRawValue(x, flipped_y, pixel1);
-			}
+			int page_x = x % VIRTUAL_TEXTURE_PAGE_SIZE;
+			int page_y = y % VIRTUAL_TEXTURE_PAGE_SIZE;
+			block = page + ((size_t)(page_y / 4) * (VIRTUAL_TEXTURE_PAGE_SIZE / 4) + page_x / 4) * m_texelSize;
 		}
+		if (m_format == Texture_Format_BC1)
+			DecodeBC1(block, cache.Texels[slot]);
+		else if (m_format == Texture_Format_BC3)
+			DecodeBC3(block, cache.Texels[slot]);
+		else
+			DecodeBC5(block, cache.Texels[slot]);
+		cache.Keys[slot] = key;
 	}
+	return cache.Texels[slot][(y & 3) * 4 + (x & 3)];
 }
 
-float ResolveTexCoord(eAddressMode addressMode, float x)
+const unsigned char* Texture::GetResidentPage(int& x, int& y, int& level) const
 {
-	if (x >= 0.0f && x <= 1.0f)
-		return x;
+	while (true)
+	{
+		const MipLevel& mip = m_mips[level];
+		uint32_t page = mip.FirstPage + (y / VIRTUAL_TEXTURE_PAGE_SIZE) * mip.PagesX + x / VIRTUAL_TEXTURE_PAGE_SIZE;
+		const unsigned char* data = m_pageCache->RequestPage(page);
+		// the last level is pinned
+		if (data != nullptr || level + 1 == (int)m_mips.size())
+			return data;
+		x = std::min(x / 2, m_mips[level + 1].Width - 1);
+		y = std::min(y / 2, m_mips[level + 1].Height - 1);
+		++level;
+	}
+}
+
+const unsigned char* Texture::GetVirtualTexelAddress(int x, int y, int level) const
+{
+	const unsigned char* page = GetResidentPage(x, y, level);
+	int page_x = x % VIRTUAL_TEXTURE_PAGE_SIZE;
+	int page_y = y % VIRTUAL_TEXTURE_PAGE_SIZE;
+	size_t tile = (size_t)(page_y / PIXEL_TILE_SIZE) * (VIRTUAL_TEXTURE_PAGE_SIZE / PIXEL_TILE_SIZE) + page_x / PIXEL_TILE_SIZE;
+	return page + (tile * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE + TileMortonIndex(page_x, page_y)) * m_texelSize;
+}
 
-	float t;
-	switch (addressMode)
+void Texture::LoadFootprint(int x0, int y0, int x1, int y1, int level, Color* colors) const
+{
+	__m128i texels;
+	if (m_format == Texture_Format_RGBA8)
 	{
-	case  Address_Mode_Border:
+		texels = _mm_setr_epi32(*(const int32_t*)GetTexelAddress(x0, y0, level), *(const int32_t*)GetTexelAddress(x1, y0, level),
+			*(const int32_t*)GetTexelAddress(x0, y1, level), *(const int32_t*)GetTexelAddress(x1, y1, level));
+	}
+	else if (IsBlockCompressed(m_format))
 	{
-		if (x > 1.0f || x < 0.0f)
-			t = -1.0f;
+		texels = _mm_setr_epi32(LoadPackedTexel(x0, y0, level), LoadPackedTexel(x1, y0, level), LoadPackedTexel(x0, y1, level), LoadPackedTexel(x1, y1, level));
 	}
-	break;
-	case Address_Mode_Clamp:
+	else
 	{
-		t = std::clamp(x, 0.0f, 1.0f);
+		colors[0] = LoadTexel(GetTexelAddress(x0, y0, level));
+		colors[1] = LoadTexel(GetTexelAddress(x1, y0, level));
+		colors[2] = LoadTexel(GetTexelAddress(x0, y1, level));
+		colors[3] = LoadTexel(GetTexelAddress(x1, y1, level));
+		return;
 	}
-	break;
-	case Address_Mode_Mirror:
+	// all four texels in one register, widened to floats
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+	__m128i lo = _mm_unpacklo_epi8(texels, zero);
+	__m128i hi = _mm_unpackhi_epi8(texels, zero);
+	_mm_storeu_ps(&colors[0].x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+	_mm_storeu_ps(&colors[1].x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+	_mm_storeu_ps(&colors[2].x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+	_mm_storeu_ps(&colors[3].x, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+}
+
+void Texture::Sample4(const SamplerState& sampler, const float2* uv, const float2& ddx, const float2& ddy, Color* colors) const
+{
+	if (sampler.Filter == Filter_Anisotropic)
 	{
-		t = std::fmodf(x, 2.0f);
-		t = t <= 1.0f ? t : 2.0f - t;
+		// the taps of each sample are batched instead
+		for (int i = 0; i < 4; ++i)
+			colors[i] = SampleAnisotropic(sampler, uv[i], ddx, ddy);
+		return;
 	}
-	break;
-	case Address_Mode_Mirror_once:
+	SampleLevel4(sampler, uv, CalculateLevelOfDetail(sampler, ddx, ddy), colors);
+}
+
+void Texture::Sample8(const SamplerState& sampler, const float2* uv, const float2& ddx, const float2& ddy, Color* colors) const
+{
+	Sample4(sampler, uv, ddx, ddy, colors);
+	Sample4(sampler, uv + 4, ddx, ddy, colors + 4);
+}
+
+float Texture::CalculateLevelOfDetail(const SamplerState& sampler, const float2& ddx, const float2& ddy) const
+{
+	// log2 of the longer axis of the pixel footprint in texels
+	float2 size = float2((float)m_width, (float)m_height);
+	float2 dx = ddx * size;
+	float2 dy = ddy * size;
+	float rho_sq = std::max(Dot(dx, dx), Dot(dy, dy));
+	return 0.5f * std::log2(std::max(rho_sq, 1e-8f)) + sampler.MipLODBias;
+}
+
+Color Texture::SampleAnisotropic(const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy) const
+{
+	float2 size = float2((float)m_width, (float)m_height);
+	float2 dx = ddx * size;
+	float2 dy = ddy * size;
+	float length_x = std::sqrt(Dot(dx, dx));
+	float length_y = std::sqrt(Dot(dy, dy));
+	float major = std::max(length_x, length_y);
+	float minor = std::min(length_x, length_y);
+	float2 axis = length_x >= length_y ? ddx : ddy;
+
+	// one tap per square-ish cell of the footprint, rounded so a footprint facing the camera, whose ratio is
+	// barely above 1, costs a single trilinear sample
+	int max_taps = std::clamp((int)sampler.MaxAnisotropy, 1, 16);
+	int taps = std::clamp((int)std::round(major / std::max(minor, 1e-6f)), 1, max_taps);
+	float level = std::log2(std::max(major / taps, 1e-4f)) + sampler.MipLODBias;
+	if (taps == 1)
+		return SampleLevel(sampler, uv, level);
+
+	Color sum = Color(0.0f, 0.0f, 0.0f, 0.0f);
+	float2 tap_uv[4];
+	Color tap_colors[4];
+	for (int i = 0; i < taps; i += 4)
+	{
+		// the spare lanes of the last batch repeat its first tap
+		int count = std::min(taps - i, 4);
+		for (int j = 0; j < 4; ++j)
+			tap_uv[j] = uv + axis * ((i + (j < count ? j : 0) + 0.5f) / taps - 0.5f);
+		SampleLevel4(sampler, tap_uv, level, tap_colors);
+		for (int j = 0; j < count; ++j)
+			sum = sum + tap_colors[j];
+	}
+	return sum / (float)taps;
+}
+
+template <eAddressMode AddressU, eAddressMode AddressV>
+Color Texture::SamplePoint(const float2& uv, int level) const
+{
+	const MipLevel& mip = m_mips[level];
+	int x = ResolveTexel<AddressU>(FloorToInt(uv.x * mip.Width), mip.Width);
+	int y = ResolveTexel<AddressV>(FloorToInt(uv.y * mip.Height), mip.Height);
+	return GetColor(x, y, level);
+}
+
+template <eAddressMode AddressU, eAddressMode AddressV>
+Color Texture::SampleBilinear(const float2& uv, int level) const
+{
+	if (m_pageCache != nullptr)
+	{
+		// the whole footprint comes from one level, texels of neighbouring pages still streaming fall back on their own
+		int x = ResolveTexel<AddressU>(FloorToInt(uv.x * m_mips[level].Width), m_mips[level].Width);
+		int y = ResolveTexel<AddressV>(FloorToInt(uv.y * m_mips[level].Height), m_mips[level].Height);
+		GetResidentPage(x, y, level);
+	}
+	const MipLevel& mip = m_mips[level];
+	// texel centers are at half texels, the footprint starts at the floor
+	float x = uv.x * mip.Width - 0.5f;
+	float y = uv.y * mip.Height - 0.5f;
+	int x0 = FloorToInt(x);
+	int y0 = FloorToInt(y);
+	Color c[4];
+	LoadFootprint(ResolveTexel<AddressU>(x0, mip.Width), ResolveTexel<AddressV>(y0, mip.Height),
+		ResolveTexel<AddressU>(x0 + 1, mip.Width), ResolveTexel<AddressV>(y0 + 1, mip.Height), level, c);
+	return BlendFootprint(c, x - x0, y - y0);
+}
+
+template <eAddressMode AddressU, eAddressMode AddressV>
+void Texture::SampleBilinear4(const float2* uv, int level, Color* colors) const
+{
+	if (m_pageCache != nullptr)
+	{
+		// the resident level can differ per sample
+		for (int i = 0; i < 4; ++i)
+			colors[i] = SampleBilinear<AddressU, AddressV>(uv[i], level);
+		return;
+	}
+	const MipLevel& mip = m_mips[level];
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(_mm_setr_ps(uv[0].x, uv[1].x, uv[2].x, uv[3].x), _mm_set1_ps((float)mip.Width)), half);
+	__m128 y = _mm_sub_ps(_mm_mul_ps(_mm_setr_ps(uv[0].y, uv[1].y, uv[2].y, uv[3].y), _mm_set1_ps((float)mip.Height)), half);
+	// floor, truncation rounds negative coordinates up
+	__m128i x0 = _mm_cvttps_epi32(x);
+	__m128i y0 = _mm_cvttps_epi32(y);
+	x0 = _mm_add_epi32(x0, _mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(x0))));
+	y0 = _mm_add_epi32(y0, _mm_castps_si128(_mm_cmplt_ps(y, _mm_cvtepi32_ps(y0))));
+	alignas(16) int xs[4];
+	alignas(16) int ys[4];
+	alignas(16) float alphas[4];
+	alignas(16) float betas[4];
+	_mm_store_si128((__m128i*)xs, x0);
+	_mm_store_si128((__m128i*)ys, y0);
+	_mm_store_ps(alphas, _mm_sub_ps(x, _mm_cvtepi32_ps(x0)));
+	_mm_store_ps(betas, _mm_sub_ps(y, _mm_cvtepi32_ps(y0)));
+	for (int i = 0; i < 4; ++i)
 	{
-		t = std::clamp(std::fabs(x), 0.0f, 1.0f);
+		Color c[4];
+		LoadFootprint(ResolveTexel<AddressU>(xs[i], mip.Width), ResolveTexel<AddressV>(ys[i], mip.Height),
+			ResolveTexel<AddressU>(xs[i] + 1, mip.Width), ResolveTexel<AddressV>(ys[i] + 1, mip.Height), level, c);
+		colors[i] = BlendFootprint(c, alphas[i], betas[i]);
 	}
+}
+
+template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+Color Texture::SampleLevelImpl(const Texture& texture, const SamplerState& sampler, const float2& uv, float level)
+{
+	if (IsBorder<AddressU>(uv.x) || IsBorder<AddressV>(uv.y))
+		return sampler.BorderColor;
+	int max_level = (int)texture.m_mips.size() - 1;
+	level = std::clamp(level, 0.0f, (float)max_level);
+	if (Filter == Filter_Min_Mag_Mip_Point)
+		return texture.SamplePoint<AddressU, AddressV>(uv, (int)(level + 0.5f));
+	if (Filter == Filter_Min_Mag_Linear_Mip_Point)
+		return texture.SampleBilinear<AddressU, AddressV>(uv, (int)(level + 0.5f));
+	// trilinear, also the taps of Filter_Anisotropic
+	int level0 = (int)level;
+	int level1 = std::min(level0 + 1, max_level);
+	float t = level - level0;
+	Color c0 = texture.SampleBilinear<AddressU, AddressV>(uv, level0);
+	if (t == 0.0f || level0 == level1)
+		return c0;
+	return Lerp(c0, texture.SampleBilinear<AddressU, AddressV>(uv, level1), t);
+}
+
+template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+void Texture::SampleLevel4Impl(const Texture& texture, const SamplerState& sampler, const float2* uv, float level, Color* colors)
+{
+	if (Filter == Filter_Min_Mag_Mip_Point || AddressU == Address_Mode_Border || AddressV == Address_Mode_Border)
+	{
+		// point samples have nothing to share, and borders are rare enough to take one at a time
+		for (int i = 0; i < 4; ++i)
+			colors[i] = SampleLevelImpl<Filter, AddressU, AddressV>(texture, sampler, uv[i], level);
+		return;
+	}
+	int max_level = (int)texture.m_mips.size() - 1;
+	level = std::clamp(level, 0.0f, (float)max_level);
+	if (Filter == Filter_Min_Mag_Linear_Mip_Point)
+	{
+		texture.SampleBilinear4<AddressU, AddressV>(uv, (int)(level + 0.5f), colors);
+		return;
+	}
+	int level0 = (int)level;
+	int level1 = std::min(level0 + 1, max_level);
+	float t = level - level0;
+	texture.SampleBilinear4<AddressU, AddressV>(uv, level0, colors);
+	if (t == 0.0f || level0 == level1)
+		return;
+	Color colors1[4];
+	texture.SampleBilinear4<AddressU, AddressV>(uv, level1, colors1);
+	for (int i = 0; i < 4; ++i)
+		colors[i] = Lerp(colors[i], colors1[i], t);
+}
+
+template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+Color Texture::SampleImpl(const Texture& texture, const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy)
+{
+	if (Filter == Filter_Anisotropic)
+		return texture.SampleAnisotropic(sampler, uv, ddx, ddy);
+	return SampleLevelImpl<Filter, AddressU, AddressV>(texture, sampler, uv, texture.CalculateLevelOfDetail(sampler, ddx, ddy));
+}
+
+void SamplerState::Compile()
+{
+	Texture::CompileSampler(*this);
+	CompiledFilter = Filter;
+	CompiledAddressU = AddressU;
+	CompiledAddressV = AddressV;
+}
+
+void Texture::CompileSampler(SamplerState& sampler)
+{
+	switch (sampler.Filter)
+	{
+	case Filter_Min_Mag_Mip_Point:
+		CompileSamplerU<Filter_Min_Mag_Mip_Point>(sampler);
+		break;
+	case Filter_Min_Mag_Mip_Linear:
+		CompileSamplerU<Filter_Min_Mag_Mip_Linear>(sampler);
+		break;
+	case Filter_Anisotropic:
+		CompileSamplerU<Filter_Anisotropic>(sampler);
+		break;
+	default:
+		CompileSamplerU<Filter_Min_Mag_Linear_Mip_Point>(sampler);
 		break;
-	case Address_Mode_Warp:
+	}
+}
+
+template <eFilter Filter>
+void Texture::CompileSamplerU(SamplerState& sampler)
+{
+	switch (sampler.AddressU)
 	{
-		t = std::fmodf(x, 1.0f);
+	case Address_Mode_Mirror:
+		CompileSamplerV<Filter, Address_Mode_Mirror>(sampler);
+		break;
+	case Address_Mode_Clamp:
+		CompileSamplerV<Filter, Address_Mode_Clamp>(sampler);
+		break;
+	case Address_Mode_Border:
+		CompileSamplerV<Filter, Address_Mode_Border>(sampler);
+		break;
+	case Address_Mode_Mirror_once:
+		CompileSamplerV<Filter, Address_Mode_Mirror_once>(sampler);
+		break;
+	default:
+		CompileSamplerV<Filter, Address_Mode_Warp>(sampler);
+		break;
 	}
+}
+
+template <eFilter Filter, eAddressMode AddressU>
+void Texture::CompileSamplerV(SamplerState& sampler)
+{
+	switch (sampler.AddressV)
+	{
+	case Address_Mode_Mirror:
+		SetSamplerFuncs<Filter, AddressU, Address_Mode_Mirror>(sampler);
+		break;
+	case Address_Mode_Clamp:
+		SetSamplerFuncs<Filter, AddressU, Address_Mode_Clamp>(sampler);
+		break;
+	case Address_Mode_Border:
+		SetSamplerFuncs<Filter, AddressU, Address_Mode_Border>(sampler);
+		break;
+	case Address_Mode_Mirror_once:
+		SetSamplerFuncs<Filter, AddressU, Address_Mode_Mirror_once>(sampler);
+		break;
+	default:
+		SetSamplerFuncs<Filter, AddressU, Address_Mode_Warp>(sampler);
 		break;
 	}
-	return t;
 }
 
-float2 ResolveTexCoord(eAddressMode addressModeU, eAddressMode addressModeV, const float2& uv)
+template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+void Texture::SetSamplerFuncs(SamplerState& sampler)
 {
-	float2 r_uv;
-	r_uv.x = ResolveTexCoord(addressModeU, uv.x);
-	r_uv.y = ResolveTexCoord(addressModeV, uv.y);
-	return r_uv;
+	sampler.pSampleLevel = &SampleLevelImpl<Filter, AddressU, AddressV>;
+	sampler.pSampleLevel4 = &SampleLevel4Impl<Filter, AddressU, AddressV>;
+	sampler.pSample = &SampleImpl<Filter, AddressU, AddressV>;
+}
+
+template <eAddressMode Mode>
+int ResolveTexel(int x, int dim)
+{
+	// samples outside a border texture never get here, their footprint only has to stay in bounds
+	if (Mode == Address_Mode_Clamp || Mode == Address_Mode_Border)
+		return std::clamp(x, 0, dim - 1);
+	if (Mode == Address_Mode_Mirror_once)
+		return std::min(x < 0 ? -x - 1 : x, dim - 1);
+	if (Mode == Address_Mode_Mirror)
+	{
+		int period = Warp(x, dim * 2);
+		return period < dim ? period : dim * 2 - 1 - period;
+	}
+	return Warp(x, dim);
+}
+
+template <eAddressMode Mode>
+bool IsBorder(float x)
+{
+	return Mode == Address_Mode_Border && (x < 0.0f || x > 1.0f);
 }
 
 int Warp(int x, int dim)
@@ -302,5 +902,64 @@ int Warp(int x, int dim)
 	if (x >= 0 && x < dim)
 		return x;
 	x = x % dim;
-	return x > 0 ? x : dim + x;
+	return x >= 0 ? x : dim + x;
+}
+
+int GetTexelSize(eTextureFormat format)
+{
+	switch (format)
+	{
+	case Texture_Format_RGBA8:
+		return 4;
+	case Texture_Format_RGBA16F:
+		return 8;
+	case Texture_Format_BC1:
+		return BC1_BLOCK_SIZE;
+	case Texture_Format_BC3:
+		return BC3_BLOCK_SIZE;
+	case Texture_Format_BC5:
+		return BC5_BLOCK_SIZE;
+	default:
+		return 16;
+	}
+}
+
+bool IsBlockCompressed(eTextureFormat format)
+{
+	return format == Texture_Format_BC1 || format == Texture_Format_BC3 || format == Texture_Format_BC5;
+}
+
+uint32_t NewBufferId()
+{
+	// 0 marks an empty slot in the decoded block cache
+	static std::atomic<uint32_t> next_id{ 1 };
+	return next_id++;
+}
+
+Color UnpackTexelRGBA8(uint32_t texel)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)texel), zero), zero);
+	Color col;
+	_mm_storeu_ps(&col.x, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / 255.0f)));
+	return col;
+}
+
+int FloorToInt(float x)
+{
+	int i = (int)x;
+	return i - (x < (float)i);
+}
+
+Color BlendFootprint(const Color* colors, float alpha, float beta)
+{
+	// c00, c10, c01, c11
+	__m128 c00 = _mm_loadu_ps(&colors[0].x);
+	__m128 c01 = _mm_loadu_ps(&colors[2].x);
+	__m128 a = _mm_set1_ps(alpha);
+	__m128 top = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&colors[1].x), c00), a));
+	__m128 bottom = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&colors[3].x), c01), a));
+	Color col;
+	_mm_storeu_ps(&col.x, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(beta))));
+	return col;
 }
\ No newline at end of file
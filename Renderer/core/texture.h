@@ -1,9 +1,27 @@
 #pragma once
 #include <string>
+#include <cassert>
+#include <vector>
 #include "math/math.h"
 #include "Sampler.h"
 #include "pixel_buffer.h"
 
+class VirtualTextureCache;
+
+enum eTextureFormat
+{
+	Texture_Format_RGBA8,
+	// for hot or hdr textures, no unpacking at all for RGBA32F
+	Texture_Format_RGBA16F,
+	Texture_Format_RGBA32F,
+	// block compressed, 4x4 blocks in row order. read only, blocks are decoded through a small per-thread cache
+	Texture_Format_BC1,
+	Texture_Format_BC3,
+	Texture_Format_BC5
+};
+
+// texels are stored in 8x8 tiles with morton order inside a tile, like tiled pixel buffers,
+// so the 2x2 footprint of a bilinear fetch usually stays within one or two cache lines
 class Texture
 {
 public:
@@ -11,22 +29,125 @@ public:
 	Texture(const std::string& name);
 	~Texture();
 	void LoadFromTGA(const std::string& path);
-	void Create(int width, int height, int channels);
+	// channels is what the source had, texels are always stored with four
+	void Create(int width, int height, int channels, eTextureFormat format = Texture_Format_RGBA8);
+	// box filters the full mip chain from level 0, called by LoadFromTGA
+	void GenerateMips();
+	// converts every mip level in place, encoding or decoding blocks for the bc formats
+	void ConvertFormat(eTextureFormat format);
+	// moves the mips into VIRTUAL_TEXTURE_PAGE_SIZE pages of the cache, which streams in the pages that get sampled.
+	// samples fall back to the finest resident level, the texture is read only afterwards
+	void MakeVirtual(VirtualTextureCache* cache);
+	bool IsVirtual() const { return m_pageCache != nullptr; }
 	int GetWidth() const { return m_width; }
 	int GetHeight() const { return m_height; }
 	int GetChannels() const { return m_channels; }
+	eTextureFormat GetFormat() const { return m_format; }
+	int GetMipCount() const { return (int)m_mips.size(); }
 	size_t GetSize() const { return m_size; }
 	Vec4<unsigned char> GetRawValue(int x, int y);
 	void SetRawValue(int x, int y, const Vec4<unsigned char>& raw);
-	float4 GetColor(int x, int y) const;
+	float4 GetColor(int x, int y, int level = 0) const;
 	void SetColor(int x, int y, const float4& col);
+	// whether the texels decode to unit vectors facing +z, like a tangent space normal map. gray bump height maps don't
+	bool IsTangentSpaceNormalMap() const;
 
-	Color SampleLevel(const SamplerState& sampler, const float2& uv, int level = 0) const;
+	// the sampler has to be compiled for its current fields, see SamplerState::Compile.
+	// level is fractional for linear mip filters and rounded to the nearest mip for the mip point filters
+	Color SampleLevel(const SamplerState& sampler, const float2& uv, float level = 0.0f) const
+	{
+		assert(sampler.IsCompiled() && "sampler changed since it was compiled");
+		return sampler.pSampleLevel(*this, sampler, uv, level);
+	}
+	// level of detail from the screen space uv derivatives, see PSInput
+	Color Sample(const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy) const
+	{
+		assert(sampler.IsCompiled() && "sampler changed since it was compiled");
+		return sampler.pSample(*this, sampler, uv, ddx, ddy);
+	}
+	float CalculateLevelOfDetail(const SamplerState& sampler, const float2& ddx, const float2& ddy) const;
+	// batches of four or eight samples sharing a level of detail, like a pixel quad or a span, coordinates are computed for four at once
+	void SampleLevel4(const SamplerState& sampler, const float2* uv, float level, Color* colors) const
+	{
+		assert(sampler.IsCompiled() && "sampler changed since it was compiled");
+		sampler.pSampleLevel4(*this, sampler, uv, level, colors);
+	}
+	void Sample4(const SamplerState& sampler, const float2* uv, const float2& ddx, const float2& ddy, Color* colors) const;
+	void Sample8(const SamplerState& sampler, const float2* uv, const float2& ddx, const float2& ddy, Color* colors) const;
 private:
+	friend struct SamplerState;
+
+	struct MipLevel
+	{
+		int Width;
+		int Height;
+		int TilesX;
+		// in bytes, padded to whole tiles. tiles are the 4x4 blocks for bc formats
+		size_t Offset;
+		size_t Size;
+		// virtual textures only
+		int PagesX;
+		uint32_t FirstPage;
+	};
+
+	MipLevel MakeMipLevel(int width, int height, size_t offset) const;
+	size_t GetTexelIndex(int x, int y, int level) const
+	{
+		const MipLevel& mip = m_mips[level];
+		size_t tile = (size_t)(y / PIXEL_TILE_SIZE) * mip.TilesX + x / PIXEL_TILE_SIZE;
+		return mip.Offset + (tile * PIXEL_TILE_SIZE * PIXEL_TILE_SIZE + TileMortonIndex(x, y)) * m_texelSize;
+	}
+	const unsigned char* GetTexelAddress(int x, int y, int level) const
+	{
+		if (m_pageCache == nullptr)
+			return m_buffer + GetTexelIndex(x, y, level);
+		return GetVirtualTexelAddress(x, y, level);
+	}
+	// the page of the finest resident level at or above level covering the texel, x, y and level are moved to that level
+	const unsigned char* GetResidentPage(int& x, int& y, int& level) const;
+	const unsigned char* GetVirtualTexelAddress(int x, int y, int level) const;
+	void ReleasePages();
+	Color LoadTexel(const unsigned char* texel) const;
+	// rgba8, decoded for bc formats
+	uint32_t LoadPackedTexel(int x, int y, int level) const;
+	void StoreTexel(size_t index, const Color& color);
+	// c00, c10, c01, c11
+	void LoadFootprint(int x0, int y0, int x1, int y1, int level, Color* colors) const;
+
+	template <eAddressMode AddressU, eAddressMode AddressV>
+	Color SamplePoint(const float2& uv, int level) const;
+	template <eAddressMode AddressU, eAddressMode AddressV>
+	Color SampleBilinear(const float2& uv, int level) const;
+	template <eAddressMode AddressU, eAddressMode AddressV>
+	void SampleBilinear4(const float2* uv, int level, Color* colors) const;
+	Color SampleAnisotropic(const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy) const;
+
+	// the instances behind the compiled sampler functions
+	template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+	static Color SampleLevelImpl(const Texture& texture, const SamplerState& sampler, const float2& uv, float level);
+	template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+	static void SampleLevel4Impl(const Texture& texture, const SamplerState& sampler, const float2* uv, float level, Color* colors);
+	template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+	static Color SampleImpl(const Texture& texture, const SamplerState& sampler, const float2& uv, const float2& ddx, const float2& ddy);
+	static void CompileSampler(SamplerState& sampler);
+	template <eFilter Filter>
+	static void CompileSamplerU(SamplerState& sampler);
+	template <eFilter Filter, eAddressMode AddressU>
+	static void CompileSamplerV(SamplerState& sampler);
+	template <eFilter Filter, eAddressMode AddressU, eAddressMode AddressV>
+	static void SetSamplerFuncs(SamplerState& sampler);
+
 	std::string m_name;
 	int m_width;
 	int m_height;
 	int m_channels;
+	eTextureFormat m_format = Texture_Format_RGBA8;
+	// bytes per texel, or per block for bc formats
+	int m_texelSize = 4;
+	// identifies the contents of m_buffer in the decoded block cache
+	uint32_t m_bufferId = 0;
 	size_t m_size;
 	unsigned char* m_buffer;
+	std::vector<MipLevel> m_mips;
+	VirtualTextureCache* m_pageCache = nullptr;
 };
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "texture_cache.h"
+#include "asset_loader.h"
+#include "omp.h"
+#include <filesystem>
+
+std::string MakeTextureKey(const std::string& path, const TextureLoadDesc& desc);
+void PrepareTexture(Texture* texture, const TextureLoadDesc& desc);
+
+TextureCache& TextureCache::Get()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+std::shared_ptr<Texture> TextureCache::Load(const std::string& path, const TextureLoadDesc& desc /* = TextureLoadDesc() */, AssetLoader* loader /* = nullptr */)
+{
+	std::string key = MakeTextureKey(path, desc);
+	std::shared_ptr<Texture> texture;
+	std::shared_future<void> loaded;
+	std::shared_ptr<std::promise<void>> load_done;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_entries.find(key);
+		if (iter != m_entries.end())
+		{
+			texture = iter->second.Handle.lock();
+			loaded = iter->second.Loaded;
+		}
+		if (texture == nullptr)
+		{
+			// drop the entries of freed textures while at it
+			for (auto entry = m_entries.begin(); entry != m_entries.end();)
+				entry = entry->second.Handle.expired() ? m_entries.erase(entry) : std::next(entry);
+			texture = std::make_shared<Texture>(path);
+			load_done = std::make_shared<std::promise<void>>();
+			m_entries[key] = { texture, load_done->get_future().share() };
+		}
+	}
+
+	if (load_done == nullptr)
+	{
+		if (loader == nullptr)
+			loaded.wait();
+		return texture;
+	}
+	// the entry keeps only the future, so the job's reference is the only one besides the caller's
+	auto load = [texture, path, desc, load_done]()
+	{
+		texture->LoadFromTGA(path);
+		PrepareTexture(texture.get(), desc);
+		load_done->set_value();
+	};
+	if (loader != nullptr)
+	{
+		loader->Submit([load]()
+		{
+			// every worker decodes a texture of its own, the tiling and mip loops of this one stay on its worker
+			// instead of starting a team per worker. the setting is per thread, the next job gets it back
+			int max_threads = omp_get_max_threads();
+			omp_set_num_threads(1);
+			load();
+			omp_set_num_threads(max_threads);
+		});
+	}
+	else
+		load();
+	return texture;
+}
+
+size_t TextureCache::GetCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t count = 0;
+	for (auto& entry : m_entries)
+		count += entry.second.Handle.expired() ? 0 : 1;
+	return count;
+}
+
+std::string MakeTextureKey(const std::string& path, const TextureLoadDesc& desc)
+{
+	std::error_code error;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(std::filesystem::path(path), error);
+	std::string key = error ? path : canonical.string();
+	key += desc.Compress ? (desc.NormalMap ? "|bc5" : "|bc") : "|rgba8";
+	if (desc.pPageCache != nullptr)
+		key += "|virtual " + std::to_string((uintptr_t)desc.pPageCache);
+	return key;
+}
+
+void PrepareTexture(Texture* texture, const TextureLoadDesc& desc)
+{
+	if (texture->GetWidth() == 0)
+		return;
+	// bc5 drops blue and rebuilds it as the normal's z, which would corrupt a height map used as a bump map
+	if (desc.Compress && desc.NormalMap && texture->IsTangentSpaceNormalMap())
+		texture->ConvertFormat(Texture_Format_BC5);
+	else if (desc.Compress)
+		texture->ConvertFormat(texture->GetChannels() == 4 ? Texture_Format_BC3 : Texture_Format_BC1);
+	if (desc.pPageCache != nullptr)
+		texture->MakeVirtual(desc.pPageCache);
+}
\ No newline at end of file
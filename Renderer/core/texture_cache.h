@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <unordered_map>
+#include "texture.h"
+
+class VirtualTextureCache;
+class AssetLoader;
+
+// what a texture is turned into after loading, textures loaded the same way from the same file are shared
+struct TextureLoadDesc
+{
+	// bc1, or bc3 when the file has alpha
+	bool Compress = false;
+	// bc5 when compressed, if the texels really are a tangent space normal map. height maps stay bc1
+	bool NormalMap = false;
+	VirtualTextureCache* pPageCache = nullptr;
+};
+
+// process wide cache of loaded textures keyed by canonical path and load desc. it only holds weak references,
+// a texture is freed with its last handle and loaded again when requested after that
+class TextureCache
+{
+public:
+	static TextureCache& Get();
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// with a loader the texture decodes on its threads, wait on the loader before sampling it.
+	// without one the texture is complete on return, even when another loader is still decoding it
+	std::shared_ptr<Texture> Load(const std::string& path, const TextureLoadDesc& desc = TextureLoadDesc(), AssetLoader* loader = nullptr);
+	// textures still alive
+	size_t GetCount();
+
+private:
+	struct Entry
+	{
+		std::weak_ptr<Texture> Handle;
+		std::shared_future<void> Loaded;
+	};
+
+	TextureCache() = default;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_entries;
+};
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include "texture_compression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void EncodeColorBlock(const uint32_t* texels, uint8_t* block);
+void DecodeColorBlock(const uint8_t* block, uint32_t* texels, bool allowTransparent);
+void EncodeAlphaBlock(const uint32_t* texels, int channel, uint8_t* block);
+void DecodeAlphaBlock(const uint8_t* block, uint8_t* values);
+uint16_t PackRGB565(int r, int g, int b);
+void UnpackRGB565(uint16_t color, int* rgb);
+
+void EncodeBC1(const uint32_t* texels, uint8_t* block)
+{
+	EncodeColorBlock(texels, block);
+}
+
+void EncodeBC3(const uint32_t* texels, uint8_t* block)
+{
+	EncodeAlphaBlock(texels, 3, block);
+	EncodeColorBlock(texels, block + 8);
+}
+
+void EncodeBC5(const uint32_t* texels, uint8_t* block)
+{
+	EncodeAlphaBlock(texels, 0, block);
+	EncodeAlphaBlock(texels, 1, block + 8);
+}
+
+void DecodeBC1(const uint8_t* block, uint32_t* texels)
+{
+	DecodeColorBlock(block, texels, true);
+}
+
+void DecodeBC3(const uint8_t* block, uint32_t* texels)
+{
+	uint8_t alpha[16];
+	DecodeAlphaBlock(block, alpha);
+	DecodeColorBlock(block + 8, texels, false);
+	for (int i = 0; i < 16; ++i)
+		texels[i] = (texels[i] & 0x00FFFFFF) | ((uint32_t)alpha[i] << 24);
+}
+
+void DecodeBC5(const uint8_t* block, uint32_t* texels)
+{
+	uint8_t red[16];
+	uint8_t green[16];
+	DecodeAlphaBlock(block, red);
+	DecodeAlphaBlock(block + 8, green);
+	for (int i = 0; i < 16; ++i)
+	{
+		float x = red[i] / 127.5f - 1.0f;
+		float y = green[i] / 127.5f - 1.0f;
+		float z = std::sqrt(std::max(1.0f - x * x - y * y, 0.0f));
+		uint32_t blue = (uint32_t)((z * 0.5f + 0.5f) * 255.0f + 0.5f);
+		texels[i] = red[i] | ((uint32_t)green[i] << 8) | (blue << 16) | 0xFF000000;
+	}
+}
+
+void EncodeColorBlock(const uint32_t* texels, uint8_t* block)
+{
+	// endpoints from the bounding box of the block, inset a little to cut the error of the extremes
+	int min_rgb[3] = { 255, 255, 255 };
+	int max_rgb[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			int v = (texels[i] >> (c * 8)) & 0xFF;
+			min_rgb[c] = std::min(min_rgb[c], v);
+			max_rgb[c] = std::max(max_rgb[c], v);
+		}
+	}
+	for (int c = 0; c < 3; ++c)
+	{
+		int inset = (max_rgb[c] - min_rgb[c]) / 16;
+		min_rgb[c] += inset;
+		max_rgb[c] -= inset;
+	}
+
+	uint16_t color0 = PackRGB565(max_rgb[0], max_rgb[1], max_rgb[2]);
+	uint16_t color1 = PackRGB565(min_rgb[0], min_rgb[1], min_rgb[2]);
+	if (color0 < color1)
+		std::swap(color0, color1);
+	std::memcpy(block, &color0, 2);
+	std::memcpy(block + 2, &color1, 2);
+
+	uint32_t indices = 0;
+	if (color0 != color1)
+	{
+		int palette[4][3];
+		UnpackRGB565(color0, palette[0]);
+		UnpackRGB565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 0;
+			int best_error = INT32_MAX;
+			for (int p = 0; p < 4; ++p)
+			{
+				int error = 0;
+				for (int c = 0; c < 3; ++c)
+				{
+					int d = (int)((texels[i] >> (c * 8)) & 0xFF) - palette[p][c];
+					error += d * d;
+				}
+				if (error < best_error)
+				{
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+	std::memcpy(block + 4, &indices, 4);
+}
+
+void DecodeColorBlock(const uint8_t* block, uint32_t* texels, bool allowTransparent)
+{
+	uint16_t color0;
+	uint16_t color1;
+	uint32_t indices;
+	std::memcpy(&color0, block, 2);
+	std::memcpy(&color1, block + 2, 2);
+	std::memcpy(&indices, block + 4, 4);
+
+	int rgb[4][3];
+	UnpackRGB565(color0, rgb[0]);
+	UnpackRGB565(color1, rgb[1]);
+	bool four_colors = color0 > color1 || !allowTransparent;
+	for (int c = 0; c < 3; ++c)
+	{
+		if (four_colors)
+		{
+			rgb[2][c] = (2 * rgb[0][c] + rgb[1][c]) / 3;
+			rgb[3][c] = (rgb[0][c] + 2 * rgb[1][c]) / 3;
+		}
+		else
+		{
+			rgb[2][c] = (rgb[0][c] + rgb[1][c]) / 2;
+			rgb[3][c] = 0;
+		}
+	}
+	uint32_t palette[4];
+	for (int p = 0; p < 4; ++p)
+		palette[p] = rgb[p][0] | (rgb[p][1] << 8) | (rgb[p][2] << 16) | 0xFF000000;
+	if (!four_colors)
+		palette[3] = 0;
+
+	for (int i = 0; i < 16; ++i)
+		texels[i] = palette[(indices >> (i * 2)) & 3];
+}
+
+void EncodeAlphaBlock(const uint32_t* texels, int channel, uint8_t* block)
+{
+	int values[16];
+	int min_value = 255;
+	int max_value = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		values[i] = (texels[i] >> (channel * 8)) & 0xFF;
+		min_value = std::min(min_value, values[i]);
+		max_value = std::max(max_value, values[i]);
+	}
+	// eight value mode, value0 > value1
+	block[0] = (uint8_t)max_value;
+	block[1] = (uint8_t)min_value;
+	uint64_t indices = 0;
+	if (max_value != min_value)
+	{
+		int palette[8];
+		palette[0] = max_value;
+		palette[1] = min_value;
+		for (int p = 2; p < 8; ++p)
+			palette[p] = ((8 - p) * max_value + (p - 1) * min_value) / 7;
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 0;
+			int best_error = INT32_MAX;
+			for (int p = 0; p < 8; ++p)
+			{
+				int error = std::abs(values[i] - palette[p]);
+				if (error < best_error)
+				{
+					best_error = error;
+					best = p;
+				}
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+	}
+	for (int b = 0; b < 6; ++b)
+		block[2 + b] = (uint8_t)(indices >> (b * 8));
+}
+
+void DecodeAlphaBlock(const uint8_t* block, uint8_t* values)
+{
+	int palette[8];
+	palette[0] = block[0];
+	palette[1] = block[1];
+	if (palette[0] > palette[1])
+	{
+		for (int p = 2; p < 8; ++p)
+			palette[p] = ((8 - p) * palette[0] + (p - 1) * palette[1]) / 7;
+	}
+	else
+	{
+		for (int p = 2; p < 6; ++p)
+			palette[p] = ((6 - p) * palette[0] + (p - 1) * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t indices = 0;
+	for (int b = 0; b < 6; ++b)
+		indices |= (uint64_t)block[2 + b] << (b * 8);
+	for (int i = 0; i < 16; ++i)
+		values[i] = (uint8_t)palette[(indices >> (i * 3)) & 7];
+}
+
+uint16_t PackRGB565(int r, int g, int b)
+{
+	return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+void UnpackRGB565(uint16_t color, int* rgb)
+{
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
\ No newline at end of file
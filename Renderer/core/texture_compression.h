@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+// 4x4 blocks, texels are rgba8 packed little endian (r in the low byte), row by row.
+// the encoders are fast bounding box fits meant for load time, not offline quality
+#define BC1_BLOCK_SIZE 8
+#define BC3_BLOCK_SIZE 16
+#define BC5_BLOCK_SIZE 16
+
+// rgb, alpha is dropped
+void EncodeBC1(const uint32_t* texels, uint8_t* block);
+// rgb plus interpolated alpha
+void EncodeBC3(const uint32_t* texels, uint8_t* block);
+// red and green each like bc3 alpha, for normal maps
+void EncodeBC5(const uint32_t* texels, uint8_t* block);
+
+void DecodeBC1(const uint8_t* block, uint32_t* texels);
+void DecodeBC3(const uint8_t* block, uint32_t* texels);
+// blue is rebuilt as the z of a unit normal from red and green
+void DecodeBC5(const uint8_t* block, uint32_t* texels);
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "virtual_texture.h"
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+bool SeekFile(FILE* file, uint64_t offset);
+
+VirtualTextureCache::VirtualTextureCache(size_t budget /* = VIRTUAL_TEXTURE_DEFAULT_BUDGET */) : m_budget(budget)
+{
+	// deleted when closed
+	m_pageFile = std::tmpfile();
+	if (m_pageFile == nullptr)
+		std::cout << "fail to create the virtual texture page file" << std::endl;
+	m_streamThread = std::thread(&VirtualTextureCache::StreamPages, this);
+}
+
+VirtualTextureCache::~VirtualTextureCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_streamMutex);
+		m_quit = true;
+	}
+	m_streamCondition.notify_one();
+	m_streamThread.join();
+	for (StreamedPage& streamed : m_streamed)
+		delete[] streamed.Data;
+	for (Page& page : m_pages)
+		delete[] page.Data;
+	if (m_pageFile != nullptr)
+		fclose(m_pageFile);
+}
+
+uint32_t VirtualTextureCache::AddPages(const unsigned char* pages, size_t pageSize, int count, int level, bool pinned)
+{
+	std::lock_guard<std::mutex> lock(m_fileMutex);
+	uint32_t first_page = (uint32_t)m_pages.size();
+	for (int i = 0; i < count; ++i)
+	{
+		m_pages.emplace_back();
+		Page& page = m_pages.back();
+		page.FileOffset = m_pageFileSize + (uint64_t)i * pageSize;
+		page.Size = pageSize;
+		page.Level = level;
+		page.Pinned = pinned;
+		if (pinned)
+		{
+			page.Data = new unsigned char[pageSize];
+			std::memcpy(page.Data, pages + i * pageSize, pageSize);
+			m_residentSize += pageSize;
+		}
+	}
+	if (m_residentSize > m_budget && pinned)
+		std::cout << "virtual texture mip tails exceed the budget of " << m_budget << " bytes" << std::endl;
+
+	size_t size = pageSize * count;
+	if (m_pageFile == nullptr || !SeekFile(m_pageFile, m_pageFileSize) || fwrite(pages, 1, size, m_pageFile) != size)
+		std::cout << "fail to write virtual texture pages" << std::endl;
+	m_pageFileSize += size;
+	return first_page;
+}
+
+void VirtualTextureCache::ReleasePages(uint32_t firstPage, int count)
+{
+	for (uint32_t id = firstPage; id < firstPage + (uint32_t)count; ++id)
+	{
+		Page& page = m_pages[id];
+		page.Released = true;
+		if (page.Data == nullptr)
+			continue;
+		if (!page.Pinned)
+			m_resident.erase(std::find(m_resident.begin(), m_resident.end(), id));
+		delete[] page.Data;
+		page.Data = nullptr;
+		m_residentSize -= page.Size;
+	}
+}
+
+void VirtualTextureCache::Update()
+{
+	// the memory of streamed pages was reserved when they were requested
+	std::vector<StreamedPage> streamed;
+	{
+		std::lock_guard<std::mutex> lock(m_streamMutex);
+		streamed.swap(m_streamed);
+	}
+	for (StreamedPage& streamed_page : streamed)
+	{
+		Page& page = m_pages[streamed_page.Id];
+		page.Pending = false;
+		m_pendingSize -= page.Size;
+		--m_pendingCount;
+		if (streamed_page.Data == nullptr)
+		{
+			// not retried, sampling keeps falling back to a coarser level
+			page.Released = true;
+			continue;
+		}
+		if (page.Released)
+		{
+			delete[] streamed_page.Data;
+			continue;
+		}
+		page.Data = streamed_page.Data;
+		page.LastUsedFrame = m_frame;
+		m_resident.push_back(streamed_page.Id);
+		m_residentSize += page.Size;
+	}
+
+	// feedback of the frame
+	std::vector<uint32_t> missing;
+	for (uint32_t id = 0; id < (uint32_t)m_pages.size(); ++id)
+	{
+		Page& page = m_pages[id];
+		if (page.RequestedFrame.load(std::memory_order_relaxed) != m_frame)
+			continue;
+		if (page.Data != nullptr)
+			page.LastUsedFrame = m_frame;
+		else if (!page.Pending && !page.Released)
+			missing.push_back(id);
+	}
+	// coarse pages first, they cover the most screen until the finer ones arrive
+	std::stable_sort(missing.begin(), missing.end(), [&](uint32_t a, uint32_t b) { return m_pages[a].Level > m_pages[b].Level; });
+
+	std::vector<StreamRequest> requests;
+	for (uint32_t id : missing)
+	{
+		Page& page = m_pages[id];
+		if (m_pendingCount >= VIRTUAL_TEXTURE_MAX_PENDING_PAGES || !MakeRoom(page.Size))
+			break;
+		page.Pending = true;
+		m_pendingSize += page.Size;
+		++m_pendingCount;
+		requests.push_back({ id, page.FileOffset, page.Size });
+	}
+	if (!requests.empty())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_streamMutex);
+			m_requests.insert(m_requests.end(), requests.begin(), requests.end());
+		}
+		m_streamCondition.notify_one();
+	}
+	++m_frame;
+}
+
+bool VirtualTextureCache::MakeRoom(size_t size)
+{
+	while (m_residentSize + m_pendingSize + size > m_budget)
+	{
+		// least recently used, pages sampled this frame are still needed
+		size_t lru = m_resident.size();
+		for (size_t i = 0; i < m_resident.size(); ++i)
+		{
+			const Page& page = m_pages[m_resident[i]];
+			if (page.LastUsedFrame != m_frame && (lru == m_resident.size() || page.LastUsedFrame < m_pages[m_resident[lru]].LastUsedFrame))
+				lru = i;
+		}
+		if (lru == m_resident.size())
+			return false;
+		Evict(lru);
+	}
+	return true;
+}
+
+void VirtualTextureCache::Evict(size_t residentIndex)
+{
+	Page& page = m_pages[m_resident[residentIndex]];
+	delete[] page.Data;
+	page.Data = nullptr;
+	m_residentSize -= page.Size;
+	m_resident[residentIndex] = m_resident.back();
+	m_resident.pop_back();
+}
+
+void VirtualTextureCache::StreamPages()
+{
+	while (true)
+	{
+		StreamRequest request;
+		{
+			std::unique_lock<std::mutex> lock(m_streamMutex);
+			m_streamCondition.wait(lock, [&]() { return m_quit || !m_requests.empty(); });
+			if (m_quit)
+				return;
+			request = m_requests.front();
+			m_requests.pop_front();
+		}
+
+		unsigned char* data = new unsigned char[request.Size];
+		{
+			std::lock_guard<std::mutex> lock(m_fileMutex);
+			if (m_pageFile == nullptr || !SeekFile(m_pageFile, request.FileOffset) || fread(data, 1, request.Size, m_pageFile) != request.Size)
+			{
+				std::cout << "fail to read virtual texture page " << request.Id << std::endl;
+				delete[] data;
+				data = nullptr;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_streamMutex);
+		m_streamed.push_back({ request.Id, data });
+	}
+}
+
+bool SeekFile(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+// in texels, a power of two multiple of the texture tile and block sizes
+#define VIRTUAL_TEXTURE_PAGE_SIZE 128
+#define VIRTUAL_TEXTURE_DEFAULT_BUDGET (64 * 1024 * 1024)
+// pages queued for streaming at once, their memory is reserved from the budget up front
+#define VIRTUAL_TEXTURE_MAX_PENDING_PAGES 16
+
+// physical page cache for virtual textures. the pages of every texture live in a page file and the
+// pages sampled in a frame are streamed in by a background thread, evicting the least recently used
+// ones to stay within the budget. pinned pages, the mip tails sampling falls back to, always stay resident
+class VirtualTextureCache
+{
+public:
+	VirtualTextureCache(size_t budget = VIRTUAL_TEXTURE_DEFAULT_BUDGET);
+	~VirtualTextureCache();
+	VirtualTextureCache(const VirtualTextureCache&) = delete;
+	VirtualTextureCache& operator=(const VirtualTextureCache&) = delete;
+
+	// appends count pages of pageSize bytes to the page file and returns the id of the first, the ids are consecutive.
+	// coarser levels are streamed first. not safe while rendering
+	uint32_t AddPages(const unsigned char* pages, size_t pageSize, int count, int level, bool pinned);
+	void ReleasePages(uint32_t firstPage, int count);
+	// records the page as sampled this frame, null until it is resident. safe from any thread while rendering
+	const unsigned char* RequestPage(uint32_t id)
+	{
+		Page& page = m_pages[id];
+		// only written once per frame, so the cache line isn't bounced between the rendering threads
+		if (page.RequestedFrame.load(std::memory_order_relaxed) != m_frame)
+			page.RequestedFrame.store(m_frame, std::memory_order_relaxed);
+		return page.Data;
+	}
+	// resolves the feedback of the frame: installs the streamed pages, evicts and queues the missing ones. call between frames
+	void Update();
+	size_t GetResidentSize() const { return m_residentSize; }
+	size_t GetBudget() const { return m_budget; }
+
+private:
+	struct Page
+	{
+		uint64_t FileOffset = 0;
+		size_t Size = 0;
+		unsigned char* Data = nullptr;
+		uint32_t LastUsedFrame = 0;
+		std::atomic<uint32_t> RequestedFrame{ 0 };
+		int Level = 0;
+		bool Pinned = false;
+		bool Pending = false;
+		bool Released = false;
+	};
+	// copied out of the page so the streaming thread never touches m_pages
+	struct StreamRequest
+	{
+		uint32_t Id;
+		uint64_t FileOffset;
+		size_t Size;
+	};
+	struct StreamedPage
+	{
+		uint32_t Id;
+		unsigned char* Data;
+	};
+
+	bool MakeRoom(size_t size);
+	void Evict(size_t residentIndex);
+	void StreamPages();
+
+	std::deque<Page> m_pages;
+	// unpinned resident pages, the eviction candidates
+	std::vector<uint32_t> m_resident;
+	size_t m_budget;
+	size_t m_residentSize = 0;
+	size_t m_pendingSize = 0;
+	int m_pendingCount = 0;
+	// starts at 1, a page requested in frame 0 was never requested
+	uint32_t m_frame = 1;
+
+	FILE* m_pageFile;
+	uint64_t m_pageFileSize = 0;
+	std::mutex m_fileMutex;
+	// requests and streamed pages shared with the streaming thread
+	std::mutex m_streamMutex;
+	std::condition_variable m_streamCondition;
+	std::deque<StreamRequest> m_requests;
+	std::vector<StreamedPage> m_streamed;
+	bool m_quit = false;
+	std::thread m_streamThread;
+};
\ No newline at end of file
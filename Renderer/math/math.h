@@ -3,6 +3,7 @@
 #include "matrix.h"
 #include "functions.h"
 #include "bounding_box.h"
+#include "packing.h"
 #include <algorithm>
 
 #define PI 3.1415626535
\ No newline at end of file
@@ -76,6 +76,24 @@ float4 Mul(const float4& v, const float4x4& m)
 	return x + y + z + w;
 }
 
+float Determinant(const float4x4& m)
+{
+	const float (*a)[4] = m.m;
+	float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+	float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+	float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+	float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+	float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+	float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+	float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+	float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+	float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+	float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+	float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+	float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+	return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
 std::ostream& operator<<(std::ostream& os, const Mat4x4& m)
 {
 
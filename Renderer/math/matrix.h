@@ -76,6 +76,8 @@ using float3x3 = Mat3x3;
 
 float4 Mul(const float4& v, const float4x4& m);
 
+float Determinant(const float4x4& m);
+
 float3 Mul(const float3& v, const float3x3& m);
 
 std::ostream& operator<<(std::ostream& os, const Mat4x4& m);
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+#include "vec.h"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// float <-> ieee half, rounds to nearest even
+inline uint16_t FloatToHalf(float value)
+{
+	uint32_t f;
+	std::memcpy(&f, &value, sizeof(f));
+	uint32_t sign = (f >> 16) & 0x8000;
+	f &= 0x7FFFFFFF;
+	uint16_t h;
+	if (f >= 0x47800000)
+	{
+		// too large for a half, inf or nan
+		h = f > 0x7F800000 ? 0x7E00 : 0x7C00;
+	}
+	else if (f < 0x38800000)
+	{
+		// denormal or zero, let the fpu do the rounding
+		const uint32_t denorm_magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+		float denorm_magic;
+		std::memcpy(&denorm_magic, &denorm_magic_bits, sizeof(float));
+		float abs_value;
+		std::memcpy(&abs_value, &f, sizeof(float));
+		abs_value += denorm_magic;
+		std::memcpy(&f, &abs_value, sizeof(float));
+		h = (uint16_t)(f - denorm_magic_bits);
+	}
+	else
+	{
+		uint32_t mant_odd = (f >> 13) & 1;
+		f += ((uint32_t)(15 - 127) << 23) + 0xFFF + mant_odd;
+		h = (uint16_t)(f >> 13);
+	}
+	return (uint16_t)(h | sign);
+}
+
+inline float HalfToFloat(uint16_t value)
+{
+	const uint32_t shifted_exp = 0x7C00 << 13;
+	uint32_t f = (uint32_t)(value & 0x7FFF) << 13;
+	uint32_t exp = f & shifted_exp;
+	f += (127 - 15) << 23;
+	if (exp == shifted_exp)
+	{
+		// inf or nan
+		f += (128 - 16) << 23;
+	}
+	else if (exp == 0)
+	{
+		// zero or denormal, renormalize
+		const uint32_t magic_bits = 113 << 23;
+		float magic, result;
+		f += 1 << 23;
+		std::memcpy(&result, &f, sizeof(float));
+		std::memcpy(&magic, &magic_bits, sizeof(float));
+		result -= magic;
+		std::memcpy(&f, &result, sizeof(float));
+	}
+	f |= (uint32_t)(value & 0x8000) << 16;
+	float result;
+	std::memcpy(&result, &f, sizeof(float));
+	return result;
+}
+
+// unit vector <-> octahedral map in snorm16, zero vectors decode to +z
+inline void OctEncode(const float3& v, int16_t encoded[2])
+{
+	float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+	float x = l1 > 0.0f ? v.x / l1 : 0.0f;
+	float y = l1 > 0.0f ? v.y / l1 : 0.0f;
+	if (v.z < 0.0f)
+	{
+		// fold the lower hemisphere over the diagonals
+		float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+	encoded[0] = (int16_t)std::lround(std::clamp(x, -1.0f, 1.0f) * 32767.0f);
+	encoded[1] = (int16_t)std::lround(std::clamp(y, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline float3 OctDecode(const int16_t encoded[2])
+{
+	float x = std::max(encoded[0] / 32767.0f, -1.0f);
+	float y = std::max(encoded[1] / 32767.0f, -1.0f);
+	float z = 1.0f - std::abs(x) - std::abs(y);
+	if (z < 0.0f)
+	{
+		float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+	return Normalize(float3(x, y, z));
+}
+
+// rgba in [0, 1] <-> r in the low byte
+inline uint32_t PackUnorm4x8(const float4& v)
+{
+	auto to_byte = [](float c) { return (uint32_t)std::lround(std::clamp(c, 0.0f, 1.0f) * 255.0f); };
+	return to_byte(v.x) | (to_byte(v.y) << 8) | (to_byte(v.z) << 16) | (to_byte(v.w) << 24);
+}
+
+inline float4 UnpackUnorm4x8(uint32_t v)
+{
+	const float scale = 1.0f / 255.0f;
+	return float4((float)(v & 0xFF) * scale, (float)((v >> 8) & 0xFF) * scale, (float)((v >> 16) & 0xFF) * scale, (float)(v >> 24) * scale);
+}
\ No newline at end of file
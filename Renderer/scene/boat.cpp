@@ -45,7 +45,10 @@ float PCF(const DepthBuffer* shadowMap, const float4& posLS)
 	{
 		for (int j = 0; j < 3; ++j)
 		{
-			float pcfDepth = shadowMap->GetValue(x + offsets[i], y + offsets[j]);
+			// the shadow map is tiled, so taps outside it don't just wrap to the next row
+			int tap_x = std::clamp(x + offsets[i], 0, shadowMap->GetWidth() - 1);
+			int tap_y = std::clamp(y + offsets[j], 0, shadowMap->GetHeight() - 1);
+			float pcfDepth = shadowMap->GetValue(tap_x, tap_y);
 			r += (depth - 0.001f < pcfDepth ? 1.0f : 0.0f);
 		}
 	}
@@ -63,14 +66,14 @@ Color BoatPS(PSInput* psInput, void** cb, void** srvs, SamplerState** samplers)
 
 	float shadow = PCF(&shadow_map, psInput->positionLS);
 
-	float4 normal_sampled = normal_tex.SampleLevel(linear_sampler, psInput->uv);
+	float4 normal_sampled = normal_tex.Sample(linear_sampler, psInput->uv, psInput->uvDdx, psInput->uvDdy);
 	float3 normal_ts = float3(normal_sampled) * 2.0f - float3(1.0f);
 	float3x3 TBN(psInput->tangent, psInput->bitangent, psInput->normal);
 	float3 normal_ws = Mul(normal_ts, TBN);
 
 	BoatPassCB* passCB = (BoatPassCB*)cb[0];
 	BoatMat * matCB = (BoatMat*)cb[1];
-	Color ambient_sampled = ambient_tex.SampleLevel(linear_sampler, psInput->uv);
+	Color ambient_sampled = ambient_tex.Sample(linear_sampler, psInput->uv, psInput->uvDdx, psInput->uvDdy);
 	float3 ambient = Mul(float3(ambient_sampled), passCB->LightColor) * 0.05f;
 
 	float diff = Dot(psInput->normal, passCB->LightDir);
@@ -82,19 +85,26 @@ Color BoatPS(PSInput* psInput, void** cb, void** srvs, SamplerState** samplers)
 	float spec = Dot(normal_ws, half_vec);
 	spec = spec < 0.0f ? 0.0f : spec;
 	spec = std::pow(spec, matCB->IndexOfRefraction);
-	float3 specular = float3(specular_tex.SampleLevel(linear_sampler, psInput->uv)) * spec;
+	float3 specular = float3(specular_tex.Sample(linear_sampler, psInput->uv, psInput->uvDdx, psInput->uvDdy)) * spec;
 
 	return Color((specular + diffuse) * shadow, 1.0);
 }
 
 void Boat::InitScene(FrameBuffer* frameBuffer, Camera& camera)
 {
-	m_boatModel.LoadFromOBJ("assets/Fishing Boat/Boat.obj");
+	// the obj parse and the texture decodes it kicks off overlap with the rest of the setup
+	AssetLoader loader;
+	ModelLoadDesc load_desc;
+	load_desc.PackVertices = true;
+	load_desc.SplitStreams = true;
+	load_desc.CompressTextures = true;
+	// the boat takes a while to parse, the cache next to it is ignored by git
+	load_desc.MeshCache = true;
+	load_desc.pPageCache = &m_textureCache;
+	load_desc.pLoader = &loader;
+	std::future<void> model_loaded = loader.Submit([&]() { m_boatModel.LoadFromOBJ("assets/Fishing Boat/Boat.obj", load_desc); });
 	m_quad.CreateAsQuad();
 
-	camera.SetTarget(m_boatModel.GetCenter());
-	camera.SetPosition(m_boatModel.GetCenter() + float3(m_boatModel.GetRadius()));
-
 	m_pipelineState.VS = BoatVS;
 	m_pipelineState.PS = BoatPS;
 	RasterizerDesc& rs_desc = m_pipelineState.RasterizerState;
@@ -106,9 +116,13 @@ void Boat::InitScene(FrameBuffer* frameBuffer, Camera& camera)
 
 	m_frameBuffer = frameBuffer;
 
-	m_depthBuffer = new DepthBuffer(m_frameBuffer->GetWidth(), m_frameBuffer->GetHeight());
+	m_colorBuffer = m_renderTargets.Acquire<HalfColorBuffer>(m_frameBuffer->GetWidth(), m_frameBuffer->GetHeight());
+	m_depthBuffer = m_renderTargets.Acquire<DepthBuffer>(m_frameBuffer->GetWidth(), m_frameBuffer->GetHeight());
 
 	// set up shadow 
+	model_loaded.wait();
+	camera.SetTarget(m_boatModel.GetCenter());
+	camera.SetPosition(m_boatModel.GetCenter() + float3(m_boatModel.GetRadius()));
 	m_directionalLight.SetWidth(1400.0f);
 	m_directionalLight.SetHeight(1400.0f);
 	m_directionalLight.SetCameraType(false);
@@ -118,6 +132,7 @@ void Boat::InitScene(FrameBuffer* frameBuffer, Camera& camera)
 
 	m_shadowTestState.VS = ShadowVS;
 	m_shadowTestState.PS = nullptr;
+	m_shadowTestState.VertexInput = Vertex_Input_Position;
 	RasterizerDesc& shadow_rs = m_shadowTestState.RasterizerState;
 	shadow_rs.CullMode = Cull_Mode_Back;
 	shadow_rs.FrontCounterClockWise = false;
@@ -125,12 +140,18 @@ void Boat::InitScene(FrameBuffer* frameBuffer, Camera& camera)
 	shadow_ds.DepthEnable = true;
 	shadow_ds.DepthFunc = Comparison_Func_Less;
 
-	m_shadowMap = new DepthBuffer(512, 512);
+	// the deck is seen at grazing angles
+	m_linearSampler.Filter = Filter_Anisotropic;
+	m_linearSampler.MaxAnisotropy = 8;
+	m_linearSampler.Compile();
 
 	m_viewport.TopLeftX = 0.0f;
 	m_viewport.TopLeftY = 0.0f;
 	m_viewport.MinDepth = 0.0f;
 	m_viewport.MaxDepth = 1.0f;
+
+	// the textures have to be complete before the first draw
+	loader.WaitAll();
 }
 
 void Boat::Update(const Timer& timer, const IO& io, Camera& camera)
@@ -143,12 +164,24 @@ void Boat::Update(const Timer& timer, const IO& io, Camera& camera)
 	m_passCB.LightDir = Normalize(m_directionalLight.GetPosition() - m_directionalLight.GetTarget());
 	m_passCB.LightIntensity = 1.0f;
 	m_passCB.DirectLightMVP = m_directionalLight.GetViewMatrix() * m_directionalLight.GetProjectionMatrix();
+
+	m_mainViewDesc.ViewProj = m_passCB.ViewMat * m_passCB.ProjMat;
+	m_mainViewDesc.ViewOrigin = camera.GetPosition() + camera.GetForward() * camera.GetNear();
+	m_shadowViewDesc.ViewProj = m_passCB.DirectLightMVP;
+	m_shadowViewDesc.ViewOrigin = m_directionalLight.GetPosition() + m_directionalLight.GetForward() * m_directionalLight.GetNear();
 	//m_passCB.DirectLightProj = m_directionalLight.GetProjectionMatrix();
 }
 
 void Boat::Draw(GraphicsContext& context)
 {
 	// shadow pass
+	m_shadowMap = m_renderTargets.Acquire<DepthBuffer>(512, 512);
+	if (m_shadowMap == nullptr || m_colorBuffer == nullptr || m_depthBuffer == nullptr)
+	{
+		// the pool already reported the failed allocation
+		m_renderTargets.Release(m_shadowMap);
+		return;
+	}
 	m_viewport.Height = 512;
 	m_viewport.Width = 512;
 	context.SetViewport(&m_viewport);
@@ -156,40 +189,49 @@ void Boat::Draw(GraphicsContext& context)
 	context.SetConstantBuffer(0, &m_passCB);
 	context.SetRenderTarget(nullptr, m_shadowMap);
 	context.SetPipelineState(&m_shadowTestState);
-	m_boatModel.Draw(context);
+	m_boatModel.Draw(context, nullptr, &m_shadowViewDesc);
 
 	m_viewport.Width = m_frameBuffer->GetWidth();
 	m_viewport.Height = m_frameBuffer->GetHeight();
 	context.SetViewport(&m_viewport);
-	context.ClearColor(m_frameBuffer, Color(0.2, 0.2, 0.2, 1.0));
+	context.ClearColor(m_colorBuffer, Color(0.2, 0.2, 0.2, 1.0));
 	context.ClearDepth(m_depthBuffer, 1.0f);
-	context.SetRenderTarget(m_frameBuffer, m_depthBuffer); 
+	context.SetRenderTarget(m_colorBuffer, m_depthBuffer); 
 	context.SetPipelineState(&m_pipelineState);
 	context.SetSRV(3, m_shadowMap);
 	auto set_mat_cxt = [&](Material* pMat) -> void
 	{
-		context.SetSRV(0, pMat->pAmbientMap);
-		context.SetSRV(1, pMat->pBumpMap1);
-		context.SetSRV(2, pMat->pSpecularMap);
+		context.SetSRV(0, pMat->pAmbientMap.get());
+		context.SetSRV(1, pMat->pBumpMap1.get());
+		context.SetSRV(2, pMat->pSpecularMap.get());
 		m_matCB.IndexOfRefraction = pMat->IndexOfRefraction;
 		context.SetConstantBuffer(1, &m_matCB);
 		context.SetSampler(0, &m_linearSampler);
 	};
-	m_boatModel.Draw(context, set_mat_cxt);
+	m_boatModel.Draw(context, set_mat_cxt, &m_mainViewDesc);
 	//m_quad.Draw(context);
+	m_renderTargets.Release(m_shadowMap);
+
+	// present
+	context.Tonemap(m_colorBuffer, m_frameBuffer, m_tonemap);
+	m_renderTargets.EndFrame();
+	// streams in the texture pages sampled this frame
+	m_textureCache.Update();
 }
 
 void Boat::Release()
 {
-	if (m_depthBuffer != nullptr)
-		delete m_depthBuffer;
-
-	if (m_shadowMap != nullptr)
-		delete m_shadowMap;
+	m_renderTargets.Release(m_colorBuffer);
+	m_renderTargets.Release(m_depthBuffer);
+	m_renderTargets.Release(m_shadowMap);
+	m_renderTargets.Trim();
 }
 
 void Boat::OnResize(int width, int height)
 {
-	delete m_depthBuffer;
-	m_depthBuffer = new DepthBuffer(width, height);
+	// released first so a shrinking window reuses the old blocks
+	m_renderTargets.Release(m_colorBuffer);
+	m_renderTargets.Release(m_depthBuffer);
+	m_colorBuffer = m_renderTargets.Acquire<HalfColorBuffer>(width, height);
+	m_depthBuffer = m_renderTargets.Acquire<DepthBuffer>(width, height);
 }
\ No newline at end of file
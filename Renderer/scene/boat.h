@@ -3,6 +3,9 @@
 #include "core/graphics.h"
 #include "core/camera.h"
 #include "core/model.h"
+#include "core/render_target_pool.h"
+#include "core/virtual_texture.h"
+#include "core/asset_loader.h"
 
 struct BoatPassCB
 {
@@ -33,11 +36,20 @@ private:
 	BoatPassCB m_passCB;
 	BoatMat m_matCB;
 	Camera m_directionalLight;
+	ModelViewDesc m_mainViewDesc;
+	ModelViewDesc m_shadowViewDesc;
 	FrameBuffer* m_frameBuffer;
+	// hdr target the main pass renders into, tonemapped into the frame buffer at the end of the frame
+	HalfColorBuffer* m_colorBuffer = nullptr;
+	TonemapDesc m_tonemap;
 	DepthBuffer* m_depthBuffer = nullptr;
+	// transient, only lives from the shadow pass to the end of the main pass
 	DepthBuffer* m_shadowMap = nullptr;
+	RenderTargetPool m_renderTargets;
 	PipelineState m_pipelineState;
 	PipelineState m_shadowTestState;
+	// declared before the model, whose textures release their pages on destruction
+	VirtualTextureCache m_textureCache;
 	Model m_boatModel;
 	Model m_quad;
 	SamplerState m_linearSampler;
@@ -16,7 +16,7 @@ VSOut TexturedBoardVS(VSInput* vsInput, void** cb)
 Color TexturedBoardPS(PSInput* psInput, void** cb, void** srvs, SamplerState** samplers)
 {
 	const Texture& diffuse_map = *(Texture*)srvs[0];
-	return diffuse_map.SampleLevel(*samplers[0], psInput->uv);
+	return diffuse_map.Sample(*samplers[0], psInput->uv, psInput->uvDdx, psInput->uvDdy);
 }
 
 void TexturedBoard::InitScene(FrameBuffer* frameBuffer, Camera& camera)
@@ -67,6 +67,7 @@ void TexturedBoard::InitScene(FrameBuffer* frameBuffer, Camera& camera)
 	m_linearSampler.AddressU = Address_Mode_Warp;
 	m_linearSampler.AddressV = Address_Mode_Warp;
 	m_linearSampler.Filter = Filter_Min_Mag_Linear_Mip_Point;
+	m_linearSampler.Compile();
 }
 
 void TexturedBoard::Update(const Timer& timer, const IO& io, Camera& camera)
@@ -1,7 +1,13 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <cstring>
 #include <cctype>
+#include <cstdlib>
+#include <clocale>
+#include <locale.h>
+#include <charconv>
+#include <algorithm>
 
 #define  TGA_HEADER_SIZE 18
 
@@ -89,4 +95,75 @@ int CountNumricComponentsInLine(const std::string& data, size_t lineBeg, size_t
 		SkipToken(data, lineBeg, lineEnd);
 	}
 	return num_components;
+}
+
+inline
+const char* SkipSpaces(const char* iter, const char* end)
+{
+	while (iter < end && (*iter == ' ' || *iter == '\t'))
+	{
+		++iter;
+	}
+	return iter;
+}
+
+// strtof in the "c" locale, plain strtof follows LC_NUMERIC and a comma decimal locale breaks every number
+inline
+float StrToFloat(const char* text, char** parsed)
+{
+#ifdef _WIN32
+	static _locale_t c_locale = _create_locale(LC_NUMERIC, "C");
+	return _strtof_l(text, parsed, c_locale);
+#else
+	static locale_t c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+	return strtof_l(text, parsed, c_locale);
+#endif
+}
+
+// the float from_chars overload is missing from the v141 toolset, so the token is copied out and
+// handed to strtof, which needs it terminated. a token too long for the copy isn't a number the obj
+// can mean, it fails instead of being cut short. iter is moved past the number
+inline
+bool ParseFloat(const char*& iter, const char* end, float& value)
+{
+	const char* begin = SkipSpaces(iter, end);
+	char text[64];
+	size_t length = 0;
+	while (begin + length < end && !IsLineEnd(begin[length]) && begin[length] != ' ' && begin[length] != '\t' && begin[length] != '/')
+	{
+		if (length == sizeof(text) - 1)
+		{
+			return false;
+		}
+		text[length] = begin[length];
+		++length;
+	}
+	text[length] = '\0';
+	char* parsed = nullptr;
+	float result = StrToFloat(text, &parsed);
+	if (parsed == text)
+	{
+		return false;
+	}
+	value = result;
+	iter = begin + (parsed - text);
+	return true;
+}
+
+// from_chars takes neither leading spaces nor a plus sign
+inline
+bool ParseInt(const char*& iter, const char* end, int& value)
+{
+	const char* begin = SkipSpaces(iter, end);
+	if (begin < end && *begin == '+')
+	{
+		++begin;
+	}
+	std::from_chars_result result = std::from_chars(begin, end, value);
+	if (result.ptr == begin || result.ec != std::errc())
+	{
+		return false;
+	}
+	iter = result.ptr;
+	return true;
 }
\ No newline at end of file